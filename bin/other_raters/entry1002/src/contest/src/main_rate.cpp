@@ -1,26 +1,47 @@
 #include <iostream>
 #include <iomanip>
+#include <memory>
 
-#include "rating/measure.hpp"
+#include "rating/rate.hpp"
 #include "avio.hpp"
+#include "audio_source.h"
 
 namespace tgvoipcontest {
 
-void init_signal_info(const std::vector<float>& data, SignalInfo& info) {
-    const size_t len = data.size();
-    info.data = Signal(data.begin(), data.end(), len + magic::DATAPADDING_MS * magic::SAMPLE_RATE_MS);
-    info.VAD = Signal(len / magic::DOWNSAMPLE);
-    info.logVAD = Signal(len / magic::DOWNSAMPLE);
-    info.n_samples = len;
-}
+class OpusReaderSource : public AudioSource {
+public:
+    using AudioSource::read;
+
+    explicit OpusReaderSource(const std::string& filename)
+        : reader{filename.c_str()} {}
+
+    size_t read(float* dst, size_t len) override {
+        while (pos == pending.size()) {
+            if (finished)
+                return 0;
+            try {
+                pending = reader.read_more();
+                pos = 0;
+            } catch (OpusNoMoreData&) {
+                finished = true;
+            }
+        }
+        size_t n = std::min(len, pending.size() - pos);
+        std::copy(pending.begin() + pos, pending.begin() + pos + n, dst);
+        pos += n;
+        return n;
+    }
 
-float compute_rate(const std::vector<float>& source, const std::vector<float>& recorded) {
-    RatingContext ctx;
-    init_signal_info(source, ctx.src);
-    init_signal_info(recorded, ctx.rec);
+private:
+    OpusReader reader;
+    std::vector<float> pending;
+    size_t pos = 0;
+    bool finished = false;
+};
 
-    measure_rate(ctx);
-    return std::clamp(ctx.rate + 0.5f, 1.0f, 5.0f);
+// Ogg Opus through OpusReader, or raw s16le 48 kHz mono samples
+std::vector<float> read_all_samples(const char* filename) {
+    return open_audio_source<OpusReaderSource>(filename)->read_all<float>();
 }
 
 std::vector<float> downsample(const std::vector<float>& src) {
@@ -46,8 +67,8 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
-    auto data1 = tgvoipcontest::downsample(tgvoipcontest::OpusReader::read_all_samples(argv[1]));
-    auto data2 = tgvoipcontest::downsample(tgvoipcontest::OpusReader::read_all_samples(argv[2]));
+    auto data1 = tgvoipcontest::downsample(tgvoipcontest::read_all_samples(argv[1]));
+    auto data2 = tgvoipcontest::downsample(tgvoipcontest::read_all_samples(argv[2]));
 
     float res = tgvoipcontest::compute_rate(data1, data2);
     std::cout << std::setprecision(4) << res << std::endl;
@@ -0,0 +1,24 @@
+#include <algorithm>
+
+#include "rate.hpp"
+
+namespace tgvoipcontest {
+
+void init_signal_info(const std::vector<float>& data, SignalInfo& info) {
+    const size_t len = data.size();
+    info.data = Signal(data.begin(), data.end(), len + magic::DATAPADDING_MS * magic::SAMPLE_RATE_MS);
+    info.VAD = Signal(len / magic::DOWNSAMPLE);
+    info.logVAD = Signal(len / magic::DOWNSAMPLE);
+    info.n_samples = len;
+}
+
+float compute_rate(const std::vector<float>& source, const std::vector<float>& recorded) {
+    RatingContext ctx;
+    init_signal_info(source, ctx.src);
+    init_signal_info(recorded, ctx.rec);
+
+    measure_rate(ctx);
+    return std::clamp(ctx.rate + 0.5f, 1.0f, 5.0f);
+}
+
+}
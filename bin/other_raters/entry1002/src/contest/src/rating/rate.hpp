@@ -0,0 +1,14 @@
+#pragma once
+
+#include <vector>
+
+#include "measure.hpp"
+
+namespace tgvoipcontest {
+
+void init_signal_info(const std::vector<float>& data, SignalInfo& info);
+
+// Both signals are mono floats at magic::SAMPLE_RATE
+float compute_rate(const std::vector<float>& source, const std::vector<float>& recorded);
+
+}
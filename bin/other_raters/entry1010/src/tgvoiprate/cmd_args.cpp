@@ -1,6 +1,7 @@
 #include "cmd_args.h"
 
 #include "utils.h"
+#include <cstdlib>
 #include <iostream>
 
 namespace tgvoiprate {
@@ -9,9 +10,19 @@ namespace tgvoiprate {
     {
         try
         {
-            throwIf(argc < 3, "not enough arguments");
-            initialSoundPath = std::string{argv[1]};
-            corruptedSoundPath = std::string{argv[2]};
+            int first = 1;
+            if (argc > 1 && std::string{argv[1]} == "--threads")
+            {
+                throwIf(argc < 3, "--threads needs a value");
+                char* end = nullptr;
+                long threads = std::strtol(argv[2], &end, 10);
+                throwIf(*argv[2] == '\0' || *end != '\0' || threads < 0, "invalid --threads value");
+                threadsCount = static_cast<unsigned>(threads);
+                first = 3;
+            }
+            throwIf(argc < first + 2, "not enough arguments");
+            initialSoundPath = std::string{argv[first]};
+            corruptedSoundPath = std::string{argv[first + 1]};
         }
         catch (const std::runtime_error&)
         {
@@ -22,6 +33,7 @@ namespace tgvoiprate {
 
     void CmdArgs::PrintUsage()
     {
-            std::cout << "USAGE: tgvoiprate /path/to/sound_A.opus /path/to/sound_output_A.opus" << std::endl;
+            std::cout << "USAGE: tgvoiprate [--threads N] /path/to/sound_A.{opus,pcm} /path/to/sound_output_A.{opus,pcm}" << std::endl
+                      << "  --threads N  rate on N threads, 0 (default) for all cores" << std::endl;
     }
 }
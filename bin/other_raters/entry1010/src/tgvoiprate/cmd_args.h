@@ -11,6 +11,8 @@ struct CmdArgs
 
     std::string initialSoundPath;
     std::string corruptedSoundPath;
+    // 0 uses all cores
+    unsigned threadsCount = 0;
 
 private:
     static void PrintUsage();
@@ -25,6 +25,9 @@
 #include <cmath>
 #include <cstddef>
 #include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <stdexcept>
 #include "fft.h"
 
@@ -37,6 +40,13 @@ using std::vector;
 static size_t reverseBits(size_t x, int n);
 
 
+// Plain complex product. operator* also handles infinities and NaNs through
+// a library call, which dominates the butterflies.
+static inline complex<double> multiply(const complex<double> &x, const complex<double> &y) {
+	return complex<double>(x.real() * y.real() - x.imag() * y.imag(), x.real() * y.imag() + x.imag() * y.real());
+}
+
+
 void fft::transform(vector<complex<double> > &vec) {
 	size_t n = vec.size();
 	if (n == 0)
@@ -58,8 +68,13 @@ void fft::inverseTransform(vector<complex<double> > &vec) {
 
 
 void fft::transformRadix2(vector<complex<double> > &vec) {
+	Plan::get(vec.size()).transform(vec.data());
+}
+
+
+fft::Plan::Plan(size_t n) :
+		n(n) {
 	// Length variables
-	size_t n = vec.size();
 	int levels = 0;  // Compute levels = floor(log2(n))
 	for (size_t temp = n; temp > 1U; temp >>= 1)
 		levels++;
@@ -67,16 +82,35 @@ void fft::transformRadix2(vector<complex<double> > &vec) {
 		throw std::domain_error("Length is not a power of 2");
 
 	// Trignometric table
-	vector<complex<double> > expTable(n / 2);
+	expTable.resize(n / 2);
 	for (size_t i = 0; i < n / 2; i++)
 		expTable[i] = std::polar(1.0, -2 * M_PI * i / n);
 
 	// Bit-reversed addressing permutation
 	for (size_t i = 0; i < n; i++) {
 		size_t j = reverseBits(i, levels);
-		if (j > i)
-			std::swap(vec[i], vec[j]);
+		if (j > i) {
+			swaps.push_back(i);
+			swaps.push_back(j);
+		}
 	}
+}
+
+
+const fft::Plan &fft::Plan::get(size_t n) {
+	static std::mutex mutex;
+	static std::map<size_t, std::unique_ptr<Plan> > plans;
+	std::lock_guard<std::mutex> lock(mutex);
+	std::unique_ptr<Plan> &plan = plans[n];
+	if (!plan)
+		plan.reset(new Plan(n));
+	return *plan;
+}
+
+
+void fft::Plan::transform(complex<double> *vec) const {
+	for (size_t i = 0; i < swaps.size(); i += 2)
+		std::swap(vec[swaps[i]], vec[swaps[i + 1]]);
 
 	// Cooley-Tukey decimation-in-time radix-2 fft
 	for (size_t size = 2; size <= n; size *= 2) {
@@ -84,7 +118,7 @@ void fft::transformRadix2(vector<complex<double> > &vec) {
 		size_t tablestep = n / size;
 		for (size_t i = 0; i < n; i += size) {
 			for (size_t j = i, k = 0; j < i + halfsize; j++, k += tablestep) {
-				complex<double> temp = vec[j + halfsize] * expTable[k];
+				complex<double> temp = multiply(vec[j + halfsize], expTable[k]);
 				vec[j + halfsize] = vec[j] - temp;
 				vec[j] += temp;
 			}
@@ -95,6 +129,53 @@ void fft::transformRadix2(vector<complex<double> > &vec) {
 }
 
 
+fft::RealPlan::RealPlan(size_t n) :
+		n(n),
+		half(Plan::get(std::max<size_t>(n / 2, 1))) {
+	if (n < 2 || (n & (n - 1)) != 0)
+		throw std::domain_error("Length is not a power of 2");
+	splitTable.resize(n / 2);
+	for (size_t i = 0; i < n / 2; i++)
+		splitTable[i] = std::polar(1.0, -2 * M_PI * i / n);
+}
+
+
+const fft::RealPlan &fft::RealPlan::get(size_t n) {
+	static std::mutex mutex;
+	static std::map<size_t, std::unique_ptr<RealPlan> > plans;
+	std::lock_guard<std::mutex> lock(mutex);
+	std::unique_ptr<RealPlan> &plan = plans[n];
+	if (!plan)
+		plan.reset(new RealPlan(n));
+	return *plan;
+}
+
+
+void fft::RealPlan::transform(const double *in, complex<double> *out) const {
+	// Even samples are the real parts, odd samples the imaginary parts
+	size_t m = n / 2;
+	for (size_t i = 0; i < m; i++)
+		out[i] = complex<double>(in[2 * i], in[2 * i + 1]);
+	half.transform(out);
+
+	// X[k] = E[k] + W^k O[k] with E and O recovered from Z[k] and Z[m - k],
+	// computed pairwise so that both bins can be overwritten in place
+	complex<double> z0 = out[0];
+	out[0] = complex<double>(z0.real() + z0.imag(), 0);
+	out[m] = complex<double>(z0.real() - z0.imag(), 0);
+	for (size_t k = 1; k <= m / 2; k++) {
+		complex<double> zk = out[k];
+		complex<double> zmk = out[m - k];
+		complex<double> evenK = (zk + std::conj(zmk)) * 0.5;
+		complex<double> oddK = (zk - std::conj(zmk)) * complex<double>(0, -0.5);
+		complex<double> evenMk = std::conj(evenK);
+		complex<double> oddMk = std::conj(oddK);
+		out[k] = evenK + multiply(splitTable[k], oddK);
+		out[m - k] = evenMk + multiply(splitTable[m - k], oddMk);
+	}
+}
+
+
 void fft::transformBluestein(vector<complex<double> > &vec) {
 	// Find a power-of-2 convolution length m such that m >= n * 2 + 1
 	size_t n = vec.size();
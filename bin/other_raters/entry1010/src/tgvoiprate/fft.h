@@ -24,6 +24,7 @@
 #pragma once
 
 #include <complex>
+#include <cstddef>
 #include <vector>
 
 
@@ -66,4 +67,48 @@ namespace fft {
 		const std::vector<std::complex<double> > &vecy,
 		std::vector<std::complex<double> > &vecout);
 
+
+	/*
+	 * Twiddle factors and the bit-reversal permutation of a radix-2 transform of one power-of-2 size.
+	 * Plans are immutable once built; get() returns a process-wide plan per size and is thread-safe.
+	 */
+	class Plan {
+	public:
+		explicit Plan(std::size_t n);
+
+		static const Plan &get(std::size_t n);
+
+		std::size_t size() const { return n; }
+
+		// In-place forward DFT of size() values
+		void transform(std::complex<double> *vec) const;
+
+	private:
+		std::size_t n;
+		std::vector<std::complex<double> > expTable;
+		std::vector<std::size_t> swaps;  // Pairs (i, j) with i < j to exchange
+	};
+
+
+	/*
+	 * Forward DFT of n real values through an n/2-point complex transform.
+	 * Writes the n/2 + 1 non-redundant bins; the rest are their conjugates.
+	 */
+	class RealPlan {
+	public:
+		explicit RealPlan(std::size_t n);
+
+		static const RealPlan &get(std::size_t n);
+
+		std::size_t size() const { return n; }
+
+		// `out` must hold size() / 2 + 1 values and is also the work area
+		void transform(const double *in, std::complex<double> *out) const;
+
+	private:
+		std::size_t n;
+		const Plan &half;
+		std::vector<std::complex<double> > splitTable;
+	};
+
 }
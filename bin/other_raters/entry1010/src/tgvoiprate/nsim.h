@@ -3,7 +3,10 @@
 #include "vector_of_columns.h"
 #include "spectorgram.h"
 
-#include <iostream>
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
 
 namespace tgvoiprate
 {
@@ -13,40 +16,147 @@ int sign(double val)
     return (0.0 < val) - (val < 0.0);
 }
 
-double NSIM(VectorOfColumns& r, VectorOfColumns& d)
-{
-    assert(r.Length() == d.Length());
-    assert(r.RowsCount() == d.RowsCount());
-
-    double L = 160;
-    double k[] = {0.1, 0.3};
-    double c1 = pow(k[0] * L, 2);
-    double c2 = pow(k[1] * L, 2) / 2;
-
-    VectorOfColumns gaussianWindow({0.0113, 0.0838, 0.0113, 0.0838, 0.6193, 0.0838, 0.0113, 0.0838, 0.0113}, 3);
-
-    auto mu_r = r.Convolve(gaussianWindow);
-    auto mu_d = d.Convolve(gaussianWindow);
-
-    auto mu_r_sq = mu_r * mu_r;
-    auto mu_d_sq = mu_d * mu_d;
-    auto mu_r_mu_d = mu_r * mu_d;
-
-    auto sigma_r = ((r * r).Convolve(gaussianWindow) - mu_r_sq)
-        .ForEach([](double& x){ x = sign(x) * sqrt(abs(x)); });
-
-    auto sigma_d = ((d * d).Convolve(gaussianWindow) - mu_d_sq)
-        .ForEach([](double& x){ x = sign(x) * sqrt(abs(x)); });
+// 3x3 Gaussian window, column by column
+static const double NSIM_WINDOW[9] = {0.0113, 0.0838, 0.0113, 0.0838, 0.6193, 0.0838, 0.0113, 0.0838, 0.0113};
 
-    auto sigma_r_d = (r * d).Convolve(gaussianWindow) - mu_r_mu_d;
+// sign(x) * sqrt(|x|) with |x| truncated to an integer first. The original
+// map-based NSIM picked up the int overload of abs(), and its scores are kept.
+inline double SignedSqrt(double x)
+{
+    return sign(x) * std::sqrt(static_cast<double>(std::abs(static_cast<int>(x))));
+}
 
-    auto L_r_d = mu_r_mu_d.ForEach([c1](double& x){ x = 2 * x + c1; })
-        / (mu_r_sq + mu_d_sq).ForEach([c1](double& x){ x = x + c1; });
+// Gaussian-weighted local mean and standard deviation around every point of
+// a spectrogram, laid out like the output of the original 3x3 convolution
+// (RowsCount() - 4 rows). They depend on one signal only, so the offset
+// search computes them once per spectrogram and every frame pair
+// reads them at its start column instead of convolving both frames again.
+class LocalMoments
+{
+public:
+    struct Frame
+    {
+        const double* means;
+        const double* sigmas;
+    };
+
+    explicit LocalMoments(const ColumnSpan& data)
+        : mRowsCount{data.RowsCount() - 4}
+        , mLength{data.Length() > 2 ? data.Length() - 2 : 0}
+        , mMeans(mRowsCount * mLength)
+        , mSigmas(mRowsCount * mLength)
+    {
+        assert(data.RowsCount() > 4);
+        for (size_t column = 0; column < mLength; ++column)
+        {
+            for (size_t row = 0; row < mRowsCount; ++row)
+            {
+                double mean = 0;
+                double square = 0;
+                for (int wndColumn = 0; wndColumn < 3; ++wndColumn)
+                {
+                    for (int wndRow = 0; wndRow < 3; ++wndRow)
+                    {
+                        const double w = NSIM_WINDOW[wndColumn * 3 + wndRow];
+                        const double x = data.At(column + wndColumn, row + wndRow);
+                        mean += w * x;
+                        square += w * (x * x);
+                    }
+                }
+                mMeans[column * mRowsCount + row] = mean;
+                mSigmas[column * mRowsCount + row] = SignedSqrt(square - mean * mean);
+            }
+        }
+    }
+
+    size_t RowsCount() const
+    {
+        return mRowsCount;
+    }
+
+    Frame At(size_t column) const
+    {
+        assert(column < mLength);
+        return Frame{mMeans.data() + column * mRowsCount, mSigmas.data() + column * mRowsCount};
+    }
+
+private:
+
+    size_t mRowsCount;
+    size_t mLength;
+    std::vector<double> mMeans;
+    std::vector<double> mSigmas;
+};
+
+// NSIM of two column-major ROWS x COLUMNS tiles in a single pass and without
+// allocations. Only the cross products depend on both tiles; the local means
+// and deviations come precomputed from LocalMoments. The cross products of
+// all output rows of a column are accumulated side by side, so the inner loop
+// vectorizes. The output has the shape the original convolution gave: the
+// window is 3x3, but (ROWS - 4) x (COLUMNS - 4) values are kept. The
+// operations happen in the order of the map-based version, so the results
+// are the same.
+template <int ROWS, int COLUMNS>
+double FusedNSIM(const double* __restrict r, LocalMoments::Frame rMoments,
+    const double* __restrict d, LocalMoments::Frame dMoments)
+{
+    const int OUT_ROWS = ROWS - 4;
+    const int OUT_COLUMNS = COLUMNS - 4;
+    // Whole SIMD lanes; the extra rows still read inside the tile and are dropped
+    const int LANES_ROWS = (OUT_ROWS + 3) / 4 * 4;
+    static_assert(OUT_ROWS > 0 && OUT_COLUMNS > 0, "The tile is smaller than the window");
+    static_assert(LANES_ROWS + 2 <= ROWS, "The padded rows must stay inside the tile");
+
+    const double L = 160;
+    const double k[] = {0.1, 0.3};
+    const double c1 = pow(k[0] * L, 2);
+    const double c2 = pow(k[1] * L, 2) / 2;
+
+    double sum = 0;
+    for (int column = 0; column < OUT_COLUMNS; ++column)
+    {
+        double r_d[LANES_ROWS] = {};
+        for (int wndColumn = 0; wndColumn < 3; ++wndColumn)
+        {
+            for (int wndRow = 0; wndRow < 3; ++wndRow)
+            {
+                const double w = NSIM_WINDOW[wndColumn * 3 + wndRow];
+                const double* rs = r + (column + wndColumn) * ROWS + wndRow;
+                const double* ds = d + (column + wndColumn) * ROWS + wndRow;
+                for (int row = 0; row < LANES_ROWS; ++row)
+                {
+                    r_d[row] += w * (rs[row] * ds[row]);
+                }
+            }
+        }
+
+        const double* mu_r = rMoments.means + column * OUT_ROWS;
+        const double* mu_d = dMoments.means + column * OUT_ROWS;
+        const double* sigma_r = rMoments.sigmas + column * OUT_ROWS;
+        const double* sigma_d = dMoments.sigmas + column * OUT_ROWS;
+        for (int row = 0; row < OUT_ROWS; ++row)
+        {
+            double mu_r_sq = mu_r[row] * mu_r[row];
+            double mu_d_sq = mu_d[row] * mu_d[row];
+            double mu_r_mu_d = mu_r[row] * mu_d[row];
+            double sigma_r_d = r_d[row] - mu_r_mu_d;
+
+            double L_r_d = (2 * mu_r_mu_d + c1) / (mu_r_sq + mu_d_sq + c1);
+            double S_r_d = (sigma_r_d + c2) / (sigma_r[row] * sigma_d[row] + c2);
+            sum += (L_r_d + S_r_d) / (OUT_ROWS * OUT_COLUMNS);
+        }
+    }
+    return sum;
+}
 
-    auto S_r_d = sigma_r_d.ForEach([c2](double& x){ x = x + c2; })
-        / (sigma_r * sigma_d).ForEach([c2](double& x){ x = x + c2; });
+// Frames of the offset search are 15 critical bands by 10 spectrogram columns
+double NSIM(const ColumnSpan& r, LocalMoments::Frame rMoments, const ColumnSpan& d, LocalMoments::Frame dMoments)
+{
+    assert(r.Length() == d.Length());
+    assert(r.RowsCount() == d.RowsCount());
+    assert(r.RowsCount() == 15 && r.Length() == 10);
 
-    return (L_r_d + S_r_d).Mean();
+    return FusedNSIM<15, 10>(r.Column(0), rMoments, d.Column(0), dMoments);
 }
 
 }
@@ -19,35 +19,30 @@ OpusFileReader::~OpusFileReader()
     }
 }
 
-std::vector<float> OpusFileReader::ReadAll()
-{
-    std::vector<float> result(65536);
-    size_t readSize = 0;
-    while (!IsEndReached())
-    {
-        readSize += ReadDataLessOrEqual(result.data() + readSize, result.size() - readSize);
-        if (readSize == result.size())
-        {
-            result.resize(readSize * 2);
-        }
-    }
-    result.resize(readSize);
-    return result;
-}
-
-bool OpusFileReader::IsEndReached()
-{
-    return op_raw_total(mOpusFile, -1) == op_raw_tell(mOpusFile);
-}
-
-size_t OpusFileReader::ReadDataLessOrEqual(float* buffer, size_t size)
+size_t OpusFileReader::read(float* buffer, size_t size)
 {
     int link;
     int samplesCount = op_read_float(mOpusFile, buffer, size, &link);
     throwIf(samplesCount < 0, "error while reading opus file, error code: " + std::to_string(samplesCount));
+    if (samplesCount == 0)
+    {
+        return 0;
+    }
     int channelCount = op_channel_count(mOpusFile, link);
     throwIf(channelCount != 1, "error while reading opus file: only monophonic files are supported");
     return static_cast<size_t>(samplesCount);
 }
 
+std::unique_ptr<AudioSource> OpenAudio(const std::string& path)
+{
+    try
+    {
+        return open_audio_source<OpusFileReader>(path);
+    }
+    catch (const std::invalid_argument& err)
+    {
+        throw std::runtime_error(err.what());
+    }
+}
+
 }
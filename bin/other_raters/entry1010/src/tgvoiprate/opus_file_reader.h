@@ -1,24 +1,26 @@
 #pragma once
 
+#include "audio_source.h"
 #include <opusfile.h>
+#include <memory>
 #include <string>
-#include <vector>
 
 namespace tgvoiprate {
 
-class OpusFileReader
+class OpusFileReader : public AudioSource
 {
 public:
     OpusFileReader(const std::string& path);
     ~OpusFileReader();
 
-    std::vector<float> ReadAll();
-    bool IsEndReached();
+    using AudioSource::read;
+    size_t read(float* buffer, size_t size) override;
 
 private:
-    size_t ReadDataLessOrEqual(float* buffer, size_t size);
-
     OggOpusFile* mOpusFile = nullptr;
 };
 
+// Decoder of an Ogg Opus file, or a reader of raw s16le 48 kHz mono samples
+std::unique_ptr<AudioSource> OpenAudio(const std::string& path);
+
 }
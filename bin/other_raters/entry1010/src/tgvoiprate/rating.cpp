@@ -0,0 +1,247 @@
+#include "rating.h"
+
+#include "vector_of_columns.h"
+#include "nsim.h"
+#include "spectorgram.h"
+#include <atomic>
+#include <cmath>
+#include <future>
+#include <limits>
+#include <map>
+#include <thread>
+
+namespace tgvoiprate {
+
+static const size_t FRAMES_PER_BATCH = 4;
+static const size_t MIN_FRAMES_PER_THREAD = 8;
+
+// Means of all frames of a spectrogram in O(1) each, from prefix sums of its
+// column sums (frames span every band, so one dimension is enough). The
+// difference of two prefix sums only decides the cutoff when it is clearly
+// away from it, beyond the rounding the prefix sums can have accumulated;
+// otherwise the frame mean is recomputed the way VectorOfColumns::Mean does,
+// so decisions don't change.
+class FrameMeans
+{
+public:
+    FrameMeans(const ColumnSpan& data, size_t frameLength)
+        : mData{data}
+        , mFrameLength{frameLength}
+        , mSize{static_cast<double>(frameLength * data.RowsCount())}
+        , mPrefixSums(data.Length() + 1)
+    {
+        double absoluteSum = 0;
+        for (size_t column = 0; column < data.Length(); ++column)
+        {
+            double columnSum = 0;
+            const double* values = data.Column(column);
+            for (size_t row = 0; row < data.RowsCount(); ++row)
+            {
+                columnSum += values[row];
+                absoluteSum += std::abs(values[row]);
+            }
+            mPrefixSums[column + 1] = mPrefixSums[column] + columnSum;
+        }
+        mTolerance = 4 * (data.Size() + 1) * std::numeric_limits<double>::epsilon() * absoluteSum / mSize;
+    }
+
+    bool IsBelow(double cutoff, size_t firstColumn) const
+    {
+        double mean = (mPrefixSums[firstColumn + mFrameLength] - mPrefixSums[firstColumn]) / mSize;
+        if (std::abs(mean - cutoff) > mTolerance + 1e-9 * (std::abs(cutoff) + 1))
+        {
+            return mean < cutoff;
+        }
+        return mData.Sub(firstColumn, mFrameLength).Mean() < cutoff;
+    }
+
+private:
+    ColumnSpan mData;
+    size_t mFrameLength;
+    double mSize;
+    std::vector<double> mPrefixSums;
+    double mTolerance;
+};
+
+// Frames are views into the spectrograms, so the search copies nothing. Frame
+// means and local moments are computed once per spectrogram, leaving only the
+// cross products of a frame pair to the inner loop. Original frames are
+// searched independently on `threadsCount` workers (all cores by default),
+// each result going to the slot of its frame, so the output is the same for
+// any number of threads.
+std::vector<std::pair<int, double>> CalcOffsetsAndSimilaritiesForFrames(const VectorOfColumns& original,
+    const VectorOfColumns& degraded, unsigned threadsCount = 0)
+{
+    int frameLength = 10;
+    int step = frameLength;
+    double cutoffMean = original.Mean();
+    ColumnSpan originalSpan = original.Span();
+    ColumnSpan degradedSpan = degraded.Span();
+    FrameMeans originalMeans{originalSpan, static_cast<size_t>(frameLength)};
+    FrameMeans degradedMeans{degradedSpan, static_cast<size_t>(frameLength)};
+    LocalMoments originalMoments{originalSpan};
+    LocalMoments degradedMoments{degradedSpan};
+
+    size_t framesCount = original.Length() >= static_cast<size_t>(frameLength) ? (original.Length() - frameLength) / step + 1 : 0;
+    // Frames below the cutoff or past the end of `degraded` keep no result
+    std::vector<std::pair<int, double>> slots(framesCount);
+    std::vector<char> found(framesCount);
+    auto searchFrame = [&](size_t frame)
+    {
+        int idxOrig = static_cast<int>(frame) * step;
+        int maxSimIdx = -1;
+        double maxSimValue = 0;
+        int searchLength = std::min(100 + frameLength, static_cast<int>(degraded.Length()) - idxOrig);
+        if (searchLength < 0) { return; }
+        if (originalMeans.IsBelow(cutoffMean, idxOrig)) { return; }
+        ColumnSpan frameOrig = originalSpan.Sub(idxOrig, frameLength);
+        LocalMoments::Frame momentsOrig = originalMoments.At(idxOrig);
+        degradedSpan.Sub(idxOrig, searchLength).ForEachFrame(frameLength, 1,
+        [&](int idxDegraded, const ColumnSpan& frameDegraded)
+        {
+            if (degradedMeans.IsBelow(cutoffMean, idxOrig + idxDegraded)) { return; }
+            double nsim = NSIM(frameOrig, momentsOrig, frameDegraded, degradedMoments.At(idxOrig + idxDegraded));
+            if (nsim > maxSimValue && nsim < 3)
+            {
+                maxSimValue = nsim;
+                maxSimIdx = idxDegraded;
+            }
+        });
+        slots[frame] = {maxSimIdx, maxSimValue};
+        found[frame] = 1;
+    };
+
+    if (threadsCount == 0)
+    {
+        threadsCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threadsCount = static_cast<unsigned>(std::max<size_t>(1, std::min<size_t>(threadsCount, framesCount / MIN_FRAMES_PER_THREAD)));
+    // Frames below the cutoff are skipped, so the work is handed out in small
+    // batches rather than fixed ranges
+    std::atomic<size_t> nextFrame{0};
+    auto searchFrames = [&]()
+    {
+        size_t begin;
+        while ((begin = nextFrame.fetch_add(FRAMES_PER_BATCH)) < framesCount)
+        {
+            for (size_t frame = begin; frame < std::min(begin + FRAMES_PER_BATCH, framesCount); ++frame)
+            {
+                searchFrame(frame);
+            }
+        }
+    };
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i < threadsCount; ++i)
+    {
+        workers.emplace_back(searchFrames);
+    }
+    searchFrames();
+    for (std::thread& worker: workers)
+    {
+        worker.join();
+    }
+
+    std::vector<std::pair<int, double>> result;
+    for (size_t frame = 0; frame < framesCount; ++frame)
+    {
+        if (found[frame]) { result.push_back(slots[frame]); }
+    }
+    return result;
+}
+
+double calcOffsetStddev(const std::vector<std::pair<int, double>>& offsetsAndSimilarities)
+{
+    VectorOfColumns offsets(1);
+
+    std::map<int, int> offsetsCount;
+    for (auto& elem: offsetsAndSimilarities)
+    {
+        if (elem.first > 0) { offsets.Append({static_cast<double>(elem.first)}); }
+    }
+    double meanOffset = offsets.Mean();
+    double x = offsets.Accumulate(0, [meanOffset](double result, double value){ return result + pow(value - meanOffset, 2); });
+    return sqrt(x / offsets.Length());
+}
+
+double calcMeanSimilarity(const std::vector<std::pair<int, double>>& offsetsAndSimilarities)
+{
+    VectorOfColumns similarities(1);
+    for (auto& elem: offsetsAndSimilarities)
+    {
+        if (elem.first > 0) { similarities.Append({elem.second}); }
+    }
+    return similarities.Mean();
+}
+
+double calcUnrecognizedPercentage(const std::vector<std::pair<int, double>>& offsetsAndSimilarities)
+{
+    double unrecognizedCount = 0;
+    for (auto& elem: offsetsAndSimilarities)
+    {
+        if (elem.first < 0) { unrecognizedCount += 1; }
+    }
+    return unrecognizedCount / offsetsAndSimilarities.size();
+}
+
+double scoreToGrade(double score, double startGrade, std::vector<std::pair<double, double>> gradeBins)
+{
+    double result = startGrade;
+    for (auto& bin: gradeBins)
+    {
+        if (score > bin.first) { result = bin.second; }
+    }
+    return result;
+}
+
+double RateSpectrograms(Spectrogram& original, Spectrogram& degraded, unsigned threadsCount)
+{
+    auto offestsAndSimilarities = CalcOffsetsAndSimilaritiesForFrames(original.Data(), degraded.Data(), threadsCount);
+
+    double offsetStddev = calcOffsetStddev(offestsAndSimilarities);
+    double meanSimilarity = calcMeanSimilarity(offestsAndSimilarities);
+    double unrecoginizedPerc = calcUnrecognizedPercentage(offestsAndSimilarities);
+
+    double grade1 = scoreToGrade(unrecoginizedPerc, 1.0, {{0.1, 0.5}, {0.27, 0.1}});
+    double grade2 = scoreToGrade(meanSimilarity, 0.5, {{1.969195, 0.65}, {1.980665, 0.8}, {1.983225, 0.9}, {1.986578, 1}});
+    double grade3 = scoreToGrade(offsetStddev, 1.0, {{9.0, 0.95}, {16, 0.8}, {20, 0.7}, {26, 0.5}});
+
+    return grade1 * grade2 * grade3 * 4 + 1;
+}
+
+// The two spectrograms don't share anything, so they are built concurrently
+// on half of the threads each; with a single thread, one after the other.
+template <typename Audio>
+static double RateAudio(Audio& originalAudio, Audio& degradedAudio, unsigned threadsCount)
+{
+    if (threadsCount == 0)
+    {
+        threadsCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+    if (threadsCount == 1)
+    {
+        Spectrogram original{originalAudio, 1};
+        Spectrogram degraded{degradedAudio, 1};
+        return RateSpectrograms(original, degraded, 1);
+    }
+
+    unsigned builderThreads = threadsCount / 2;
+    auto originalBuilder = std::async(std::launch::async, [&originalAudio, builderThreads]()
+    {
+        return Spectrogram{originalAudio, builderThreads};
+    });
+    Spectrogram degraded{degradedAudio, threadsCount - builderThreads};
+    Spectrogram original = originalBuilder.get();
+    return RateSpectrograms(original, degraded, threadsCount);
+}
+
+double Rate(const std::vector<float>& originalAudio, const std::vector<float>& degradedAudio, unsigned threadsCount)
+{
+    return RateAudio(originalAudio, degradedAudio, threadsCount);
+}
+
+double Rate(AudioSource& originalAudio, AudioSource& degradedAudio, unsigned threadsCount)
+{
+    return RateAudio(originalAudio, degradedAudio, threadsCount);
+}
+
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "audio_source.h"
+#include <vector>
+
+namespace tgvoiprate {
+
+// Grade of `degraded` against `original`, both mono 48 kHz samples, computed
+// on `threadsCount` threads (all cores by default). The grade doesn't depend
+// on the number of threads.
+double Rate(const std::vector<float>& original, const std::vector<float>& degraded, unsigned threadsCount = 0);
+
+// The same, decoding both inputs as they are rated so that only their
+// spectrograms are kept in memory
+double Rate(AudioSource& original, AudioSource& degraded, unsigned threadsCount = 0);
+
+}
@@ -1,20 +1,106 @@
 #pragma once
+#include "audio_source.h"
+#include "fft.h"
 #include "vector_of_columns.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
 #include <complex>
+#include <thread>
+#include <vector>
 
 namespace tgvoiprate
 {
 
+// Edges of the critical bands in Hz, one spectrogram row per band
+constexpr int CRITICAL_BAND_EDGES[] =
+{
+    150,  250,  350,  450,  570,  700,  840, 1000,
+    1170, 1370, 1600, 1850, 2150, 2500, 2900, 3400
+};
+constexpr size_t CRITICAL_BANDS_COUNT = sizeof(CRITICAL_BAND_EDGES) / sizeof(CRITICAL_BAND_EDGES[0]) - 1;
+
+// FFT bins [first, last) of every critical band
+struct CriticalBandBins
+{
+    int first[CRITICAL_BANDS_COUNT];
+    int last[CRITICAL_BANDS_COUNT];
+};
+
+// A band takes the bins with frequencies in (lower edge, upper edge]
+constexpr CriticalBandBins MakeCriticalBandBins(int windowSize, int sampleRate)
+{
+    CriticalBandBins result{};
+    int bin = 0;
+    for (size_t band = 0; band < CRITICAL_BANDS_COUNT; ++band)
+    {
+        while ((static_cast<double>(bin) / windowSize) * sampleRate <= CRITICAL_BAND_EDGES[band])
+        {
+            ++bin;
+        }
+        result.first[band] = bin;
+        while ((static_cast<double>(bin) / windowSize) * sampleRate <= CRITICAL_BAND_EDGES[band + 1])
+        {
+            ++bin;
+        }
+        result.last[band] = bin;
+    }
+    return result;
+}
+
 class Spectrogram
 {
 public:
-    Spectrogram(const std::vector<float>& audioData)
+    // Columns are independent, so they are computed on `threadsCount` workers
+    // (all cores by default) straight into their slots of the spectrogram
+    Spectrogram(const std::vector<float>& audioData, unsigned threadsCount = 0)
+        : mSpectrogram{BandsCount(), ColumnsCount(audioData.size())}
+    {
+        ComputeColumns(audioData.data(), 0, mSpectrogram.Length(), ResolveThreadsCount(threadsCount));
+        NormalizePower();
+        ConvertToDecibels();
+    }
+
+    // Decodes `source` as it goes and keeps only the samples of one batch of
+    // columns, so memory follows the length of the spectrogram rather than of
+    // the audio. The columns are the same as from the decoded samples.
+    Spectrogram(AudioSource& source, unsigned threadsCount = 0)
         : mSpectrogram{BandsCount()}
     {
-        for (int frameStart = 0; frameStart + WINDOW_SIZE < audioData.size(); frameStart += WINDOW_SIZE / 2)
+        threadsCount = ResolveThreadsCount(threadsCount);
+        size_t batchColumns = MIN_COLUMNS_PER_THREAD * threadsCount;
+        // The windows of a batch span one hop more than its columns, and one
+        // sample past the last window tells it is complete
+        std::vector<float> buffer((batchColumns + 1) * HOP_SIZE + 1);
+        size_t filled = 0;
+        bool finished = false;
+        while (!finished)
         {
-            ComputeSpectrogramColumn(&audioData[frameStart]);
+            while (filled < buffer.size())
+            {
+                size_t got = source.read(buffer.data() + filled, buffer.size() - filled);
+                if (got == 0)
+                {
+                    finished = true;
+                    break;
+                }
+                filled += got;
+            }
+
+            size_t columns = ColumnsCount(filled);
+            if (columns == 0)
+            {
+                continue;
+            }
+            size_t firstColumn = mSpectrogram.Length();
+            mSpectrogram.Resize(firstColumn + columns);
+            ComputeColumns(buffer.data(), firstColumn, columns, threadsCount);
+
+            size_t consumed = columns * HOP_SIZE;
+            std::copy(buffer.begin() + consumed, buffer.begin() + filled, buffer.begin());
+            filled -= consumed;
         }
+
         NormalizePower();
         ConvertToDecibels();
     }
@@ -24,44 +110,82 @@ public:
         return mSpectrogram;
     }
 
-    size_t BandsCount() { return mCriticalBandEdges.size() - 1; }
+    size_t BandsCount() { return CRITICAL_BANDS_COUNT; }
     size_t Length() { return mSpectrogram.Length(); }
 
 private:
     static const int WINDOW_SIZE = 4096;
     static const int SAMPLE_RATE = 48000;
+    static const int HOP_SIZE = WINDOW_SIZE / 2;
+    static const size_t MIN_COLUMNS_PER_THREAD = 16;
+
+    // Windows start every HOP_SIZE samples and must end before the last one
+    static size_t ColumnsCount(size_t samplesCount)
+    {
+        return samplesCount > WINDOW_SIZE ? (samplesCount - WINDOW_SIZE - 1) / HOP_SIZE + 1 : 0;
+    }
+
+    static unsigned ResolveThreadsCount(unsigned threadsCount)
+    {
+        return threadsCount != 0 ? threadsCount : std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // Computes `count` columns from `firstColumn` on, the first one windowing
+    // `audio` from its start
+    void ComputeColumns(const float* audio, size_t firstColumn, size_t count, unsigned threadsCount)
+    {
+        threadsCount = static_cast<unsigned>(std::max<size_t>(1, std::min<size_t>(threadsCount, count / MIN_COLUMNS_PER_THREAD)));
+        auto computeColumns = [&](size_t begin, size_t end)
+        {
+            std::vector<double> windowed(WINDOW_SIZE);
+            std::vector<std::complex<double>> fftFrame(WINDOW_SIZE / 2 + 1);
+            for (size_t column = begin; column < end; ++column)
+            {
+                ComputeSpectrogramColumn(&audio[column * HOP_SIZE], windowed, fftFrame, mSpectrogram.Column(firstColumn + column));
+            }
+        };
+        std::vector<std::thread> workers;
+        for (unsigned i = 1; i < threadsCount; ++i)
+        {
+            workers.emplace_back(computeColumns, count * i / threadsCount, count * (i + 1) / threadsCount);
+        }
+        computeColumns(0, count / threadsCount);
+        for (std::thread& worker: workers)
+        {
+            worker.join();
+        }
+    }
 
-    void ComputeSpectrogramColumn(const float* frame)
+    void ComputeSpectrogramColumn(const float* frame, std::vector<double>& windowed,
+        std::vector<std::complex<double>>& fftFrame, double* column)
     {
-        static std::vector<std::complex<double>> fftFrame(WINDOW_SIZE);
+        // Real input, so only the WINDOW_SIZE / 2 + 1 non-redundant bins are computed
+        static const fft::RealPlan& plan = fft::RealPlan::get(WINDOW_SIZE);
         for (int i = 0; i < WINDOW_SIZE; ++i)
         {
-            fftFrame[i] = frame[i] * mHammingWindow[i];
+            windowed[i] = frame[i] * mHammingWindow[i];
         }
-        fft::transform(fftFrame);
-        mSpectrogram.Append(GroupIntoCriticalBands(fftFrame));
+        plan.transform(windowed.data(), fftFrame.data());
+        GroupIntoCriticalBands(fftFrame, column);
     }
 
-    std::vector<double> GroupIntoCriticalBands(const std::vector<std::complex<double>>& fftFrame)
+    // Only the bins of the bands are read, about 280 of the 2049
+    void GroupIntoCriticalBands(const std::vector<std::complex<double>>& fftFrame, double* result)
     {
-        std::vector<double> result(BandsCount());
-        int currentBandIdx = 1;
-        for (int i = 0; i < fftFrame.size(); ++i)
+        static constexpr CriticalBandBins BINS = MakeCriticalBandBins(WINDOW_SIZE, SAMPLE_RATE);
+        static_assert(BINS.last[CRITICAL_BANDS_COUNT - 1] <= WINDOW_SIZE / 2 + 1, "The bands must end below the Nyquist frequency");
+        for (size_t band = 0; band < CRITICAL_BANDS_COUNT; ++band)
         {
-            double frequency = (static_cast<double>(i) / WINDOW_SIZE) * SAMPLE_RATE;
-            if (frequency > mCriticalBandEdges[currentBandIdx]) {
-                ++currentBandIdx;
-            }
-            if (currentBandIdx == mCriticalBandEdges.size())
-            {
-                break;
-            }
-            if (frequency > mCriticalBandEdges[currentBandIdx - 1])
+            double sum = result[band];
+            for (int bin = BINS.first[band]; bin < BINS.last[band]; ++bin)
             {
-                result[currentBandIdx - 1] += std::abs(fftFrame[i]);
+                // |value| without the overflow guards of std::abs (hypot), which
+                // FFT magnitudes of 16-bit audio never need
+                const std::complex<double>& value = fftFrame[bin];
+                sum += std::sqrt(value.real() * value.real() + value.imag() * value.imag());
             }
+            result[band] = sum;
         }
-        return result;
     }
 
     void NormalizePower()
@@ -95,11 +219,6 @@ private:
 
     VectorOfColumns mSpectrogram;
     const std::array<double, WINDOW_SIZE> mHammingWindow = CreateHammingWindow();
-    const std::array<int, 16> mCriticalBandEdges
-    {
-        150,  250,  350,  450,  570,  700,  840, 1000,
-        1170, 1370, 1600, 1850, 2150, 2500, 2900, 3400
-    };
 };
 
 }
@@ -9,6 +9,74 @@
 namespace tgvoiprate {
 
 
+// Read-only view of consecutive columns of a VectorOfColumns. Frames taken
+// from a spectrogram are spans, so sliding over it copies nothing.
+class ColumnSpan
+{
+public:
+    ColumnSpan(const double* data, size_t rowsCount, size_t length)
+        : mData{data}
+        , mRowsCount{rowsCount}
+        , mLength{length}
+    {}
+
+    double At(int column, int row) const
+    {
+        return mData[column * RowsCount() + row];
+    }
+
+    const double* Column(size_t column) const
+    {
+        return mData + column * RowsCount();
+    }
+
+    size_t RowsCount() const
+    {
+        return mRowsCount;
+    }
+
+    size_t Length() const
+    {
+        return mLength;
+    }
+
+    size_t Size() const
+    {
+        return mRowsCount * mLength;
+    }
+
+    ColumnSpan Sub(size_t startColumn, size_t length) const
+    {
+        assert(startColumn + length <= Length());
+        return ColumnSpan{Column(startColumn), RowsCount(), length};
+    }
+
+    double Mean() const
+    {
+        double result = 0;
+        for (size_t i = 0; i < Size(); ++i)
+        {
+            result = result + mData[i] / Size();
+        }
+        return result;
+    }
+
+    template <typename Func>
+    void ForEachFrame(int frameLength, int step, Func func) const
+    {
+        for (int i = 0; i + frameLength <= static_cast<int>(Length()); i += step)
+        {
+            func(i, Sub(i, frameLength));
+        }
+    }
+
+private:
+
+    const double* mData;
+    size_t mRowsCount;
+    size_t mLength;
+};
+
 class VectorOfColumns
 {
 public:
@@ -34,6 +102,27 @@ public:
         return mData[column * RowsCount() + row];
     };
 
+    double* Column(size_t column)
+    {
+        return mData.data() + column * RowsCount();
+    }
+
+    const double* Column(size_t column) const
+    {
+        return mData.data() + column * RowsCount();
+    }
+
+    // View of `length` columns from `startColumn`, all the rest by default
+    ColumnSpan Span(size_t startColumn = 0, size_t length = 0) const
+    {
+        assert(startColumn + length <= Length());
+        if (length == 0)
+        {
+            length = Length() - startColumn;
+        }
+        return ColumnSpan{Column(startColumn), RowsCount(), length};
+    }
+
     size_t RowsCount() const
     {
         return mRowsCount;
@@ -87,68 +176,15 @@ public:
         return *this;
     }
 
-    void ForEachFrame(int frameLength, int step, std::function<void(int, VectorOfColumns&)> func)
-    {
-        for (int i = 0; i + frameLength <= Length(); i += step)
-        {
-            VectorOfColumns frame = SubCopy(i, frameLength);
-            func(i, frame);
-        }
-    }
-
-    VectorOfColumns& CombineWith(VectorOfColumns& another, std::function<double(double, double)> op)
-    {
-        assert(another.Length() == Length());
-        assert(another.RowsCount() == RowsCount());
-        return ForEachIndexed([&another, op](int column, int row, double& value)
-        {
-            value = op(value, another.At(column, row));
-        });
-    }
-
-    VectorOfColumns operator*(VectorOfColumns& another)
-    {
-        return SubCopy().CombineWith(another, [](double a, double b){ return a * b; });
-    }
-
-    VectorOfColumns operator/(VectorOfColumns& another)
+    void ForEachFrame(int frameLength, int step, std::function<void(int, const ColumnSpan&)> func) const
     {
-        return SubCopy().CombineWith(another, [](double a, double b){ return a / b; });
+        Span().ForEachFrame(frameLength, step, func);
     }
 
-    VectorOfColumns operator+(VectorOfColumns& another)
+    // New columns are zeroed
+    void Resize(size_t length)
     {
-        return SubCopy().CombineWith(another, [](double a, double b){ return a + b; });
-    }
-
-    VectorOfColumns operator-(VectorOfColumns& another)
-    {
-        return SubCopy().CombineWith(another, [](double a, double b){ return a - b; });
-    }
-
-    VectorOfColumns Convolve(VectorOfColumns& window)
-    {
-        assert(window.RowsCount() <= RowsCount());
-        assert(window.Length() <= Length());
-        assert(window.RowsCount() % 2 == 1);
-        assert(window.Length() % 2 == 1);
-
-        VectorOfColumns result{RowsCount() - window.RowsCount() - 1, Length() - window.Length() - 1};
-        ForEachIndexed([&](int column, int row, double& value){
-            int dstColumn = column - window.Length() / 2;
-            int dstRow = row - window.RowsCount() / 2;
-            if (dstColumn < 0 || dstColumn >= result.Length()) { return; }
-            if (dstRow < 0 || dstRow >= result.RowsCount()) { return; }
-
-            window.ForEachIndexed([&](int wnd_column, int wnd_row, double& wnd_value)
-            {
-                int srcColumn = column + wnd_column - window.Length() / 2;
-                int srcRow = row + wnd_row - window.RowsCount() / 2;
-                result.At(dstColumn, dstRow) += wnd_value * this->At(srcColumn, srcRow);
-            });
-        });
-
-        return result;
+        mData.resize(length * RowsCount());
     }
 
     void Append(const std::vector<double>& column)
@@ -22,48 +22,18 @@
 #include <algorithm>
 #include <exception>
 
-#include <opus/opusfile.h>
-#include <opus.h>
 #include <pocketsphinx.h>
 #include "resampler/speex_resampler.h"
 
-Rater::Rater(const char *me, const char *nameOrig, const char *nameMod, const char *logPath)
+Rater::Rater(const std::string &modelDir, const int16_t *orig, size_t lengthOrig, const int16_t *mod, size_t lengthMod, const char *logPath)
+    : bufferOrig(orig), bufferMod(mod), lengthOrig(lengthOrig), lengthMod(lengthMod)
 {
     // Rater logs will overwrite part of pocketsphinx voice recognition logs, but we didn't need them anyway
     log = std::ofstream(logPath == nullptr ? "/dev/null" : logPath);
 
-    // Open files
-    int err = 0;
-    fileOrig = op_open_file(nameOrig, &err);
-    if (fileOrig == nullptr)
-    {
-        throw std::invalid_argument("Could not open original file!");
-    }
-    fileMod = op_open_file(nameMod, &err);
-    if (fileMod == nullptr)
-    {
-        throw std::invalid_argument("Could not open modified file!");
-    }
-
-    // Calculate length of files
-    lengthOrig = op_pcm_total(fileOrig, -1);
-    lengthMod = op_pcm_total(fileMod, -1);
-
-    throwIfOpus("Could not get length of original file: ", lengthOrig);
-    throwIfOpus("Could not get length of modified file: ", lengthMod);
-
     lengthMin = std::min(lengthOrig, lengthMod);
 
-    bufferOrig = (int16_t *)calloc(lengthOrig, sizeof(int16_t));
-    bufferMod = (int16_t *)calloc(lengthMod, sizeof(int16_t));
-
-    readToBuffer(fileOrig, bufferOrig, lengthOrig);
-    readToBuffer(fileMod, bufferMod, lengthMod);
-
-    std::filesystem::path mePath(me);
-    mePath = std::filesystem::canonical(mePath);
-    mePath = mePath.parent_path();
-    mePath += "/src/assets/model";
+    std::filesystem::path mePath(modelDir);
 
     if (!std::filesystem::exists(mePath))
     {
@@ -102,14 +72,8 @@ Rater::Rater(const char *me, const char *nameOrig, const char *nameMod, const ch
 
 Rater::~Rater()
 {
-    free(bufferOrig);
-    free(bufferMod);
     bufferOrig = nullptr;
     bufferMod = nullptr;
-    op_free(fileOrig);
-    op_free(fileMod);
-    fileOrig = nullptr;
-    fileMod = nullptr;
 
     speex_resampler_destroy(state);
     state = nullptr;
@@ -123,22 +87,12 @@ Rater::~Rater()
     log.close();
 }
 
-bool Rater::readToBuffer(OggOpusFile *file, int16_t *buffer, size_t size)
+void Rater::setResampled(const int16_t *orig16, size_t length16Orig, const int16_t *mod16, size_t length16Mod)
 {
-    int res = 0;
-    do
-    {
-        res = op_read(file, buffer, size, NULL);
-        throwIfOpus("Failure reading data!", res);
-        if (res == 0)
-        {
-            throw std::invalid_argument("Read no data!");
-        }
-
-        size -= res;
-        buffer += res;
-    } while (size);
-    return true;
+    bufferOrig16 = orig16;
+    bufferMod16 = mod16;
+    this->length16Orig = length16Orig;
+    this->length16Mod = length16Mod;
 }
 double Rater::rateLength()
 {
@@ -208,13 +162,13 @@ double Rater::rateVoiceRecognition()
     std::string recogOrig, recogMod;
 
     // First a dry run to warm up voice recognition
-    recogOrig = voiceRecognition(bufferOrig, lengthOrig, &scoreOrig);
+    recogOrig = voiceRecognition(bufferOrig, lengthOrig, bufferOrig16, length16Orig, &scoreOrig);
     log << "Recognized original (warmup, " << logmath_exp(ps_get_logmath(ps), scoreOrig) << ") " << recogOrig << std::endl;
 
     // Then recognize original buffer
-    recogOrig = voiceRecognition(bufferOrig, lengthOrig, &scoreOrig);
+    recogOrig = voiceRecognition(bufferOrig, lengthOrig, bufferOrig16, length16Orig, &scoreOrig);
     // Then recognize new buffer
-    recogMod = voiceRecognition(bufferMod, lengthMod, &scoreMod);
+    recogMod = voiceRecognition(bufferMod, lengthMod, bufferMod16, length16Mod, &scoreMod);
 
     log << "Recognized original (" << logmath_exp(ps_get_logmath(ps), scoreOrig) << ")         " << recogOrig << std::endl;
     log << "Recognized modified (" << logmath_exp(ps_get_logmath(ps), scoreMod) << ")         " << recogMod << std::endl;
@@ -227,14 +181,30 @@ double Rater::rateVoiceRecognition()
     return (php_similar_char(recogOrig.c_str(), recogOrig.length(), recogMod.c_str(), recogMod.length()) * 5.0) / recogOrig.length();
 }
 
-std::string Rater::voiceRecognition(int16_t *buffer, size_t length, int32 *score)
+std::string Rater::voiceRecognition(const int16_t *buffer, size_t length, const int16_t *buffer16, size_t length16, int32 *score)
 {
     ps_start_utt(ps);
 
-    for (size_t x = 0; x < length; x += RESAMPLE_SIZE48)
+    if (buffer16 != nullptr)
+    {
+        for (size_t x = 0; x < length16; x += RESAMPLE_SIZE16)
+        {
+            ps_process_raw(ps, buffer16 + x, std::min<size_t>(RESAMPLE_SIZE16, length16 - x), FALSE, FALSE);
+        }
+    }
+    else
     {
-        resample(buffer + x, resampleBuffer16);
-        ps_process_raw(ps, resampleBuffer16, RESAMPLE_SIZE16, FALSE, FALSE);
+        for (size_t x = 0; x < length; x += RESAMPLE_SIZE48)
+        {
+            // The last pass is zero padded instead of reading past the samples
+            int16_t tail[RESAMPLE_SIZE48] = {};
+            if (length - x < RESAMPLE_SIZE48)
+            {
+                std::copy(buffer + x, buffer + length, tail);
+            }
+            resample(length - x < RESAMPLE_SIZE48 ? tail : buffer + x, resampleBuffer16);
+            ps_process_raw(ps, resampleBuffer16, RESAMPLE_SIZE16, FALSE, FALSE);
+        }
     }
     ps_end_utt(ps);
 
@@ -271,7 +241,7 @@ double Rater::finalRateWeight()
 
     return final;
 }
-void Rater::resample(int16_t *in, int16_t *out)
+void Rater::resample(const int16_t *in, int16_t *out)
 {
     uint32_t in_len = RESAMPLE_SIZE48;
     uint32_t out_len = RESAMPLE_SIZE16;
@@ -33,20 +33,27 @@
 // 6144 samples for each voice recognition pass at 48khz (128ms)
 #define RESAMPLE_SIZE48 (RESAMPLE_SIZE16/16)*48
 
+#include <cstdint>
 #include <exception>
 #include <iostream>
 #include <fstream>
+#include <string>
 
-#include <opus/opusfile.h>
 #include <pocketsphinx.h>
 #include "resampler/speex_resampler.h"
 
 class Rater
 {
 public:
-    Rater(const char *me, const char *nameOrig, const char *nameMod, const char *logPath = nullptr);
+    // Rates decoded 48khz mono samples, which must outlive the rater; the
+    // model directory is src/assets/model next to the tgvoiprate binary
+    Rater(const std::string &modelDir, const int16_t *orig, size_t lengthOrig, const int16_t *mod, size_t lengthMod, const char *logPath = nullptr);
     ~Rater();
 
+    // Recognize voice in these 16khz copies of the samples instead of
+    // resampling them again on every pass
+    void setResampled(const int16_t *orig16, size_t length16Orig, const int16_t *mod16, size_t length16Mod);
+
     double rateLength();
     double rateSilence();
     double rateVoiceRecognition();
@@ -55,25 +62,21 @@ public:
 
     std::ofstream log;
 private:
-    std::string voiceRecognition(int16_t *buffer, size_t length, int32 *score);
-    void resample(int16_t *in, int16_t *out);
-    bool readToBuffer(OggOpusFile *file, int16_t *buffer, size_t size);
-    void throwIfOpus(const char *ctx, int err) {
-        if (err < 0) {
-            throw std::invalid_argument(std::string(ctx) + opus_strerror(err));
-        }
-    }
+    std::string voiceRecognition(const int16_t *buffer, size_t length, const int16_t *buffer16, size_t length16, int32 *score);
+    void resample(const int16_t *in, int16_t *out);
 
     ps_decoder_t *ps = NULL;
-    OggOpusFile *fileOrig = nullptr;
-    OggOpusFile *fileMod = nullptr;
 
-    int16_t *bufferOrig = nullptr;
-    int16_t *bufferMod = nullptr;
+    const int16_t *bufferOrig = nullptr;
+    const int16_t *bufferMod = nullptr;
+    const int16_t *bufferOrig16 = nullptr;
+    const int16_t *bufferMod16 = nullptr;
 
-    ogg_int64_t lengthOrig = 0;
-    ogg_int64_t lengthMod = 0;
+    size_t lengthOrig = 0;
+    size_t lengthMod = 0;
     size_t lengthMin = 0;
+    size_t length16Orig = 0;
+    size_t length16Mod = 0;
 
     SpeexResamplerState *state = speex_resampler_init(1, 48000, 16000, 10, NULL);
 
@@ -17,13 +17,18 @@
  */
 
 #include "rater.h"
+#include "audio_source.h"
 
+#include <filesystem>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <vector>
 #include <opus/opusfile.h>
 
 /*
  * $ tgvoiprate /path/to/sound_A.opus /path/to/sound_output_A.opus
+ * (raw s16le 48khz mono .pcm files are accepted as well)
  * 4.6324
  * 
  */
@@ -33,11 +38,74 @@ int usage(const char *error, const char *script)
     std::cerr << "This program comes with ABSOLUTELY NO WARRANTY; for details see the GPLv3 license." << std::endl;
     std::cerr << "This is free software, and you are welcome to redistribute it under certain conditions." << std::endl;
     std::cerr << std::endl;
-    std::cerr << "Usage: " << script << " orig.opus modified.opus [logfile.log]" << std::endl;
+    std::cerr << "Usage: " << script << " orig.{opus,pcm} modified.{opus,pcm} [logfile.log]" << std::endl;
     std::cerr << error << std::endl;
     return 1;
 }
 
+void throwIfOpus(const char *ctx, int err)
+{
+    if (err < 0)
+    {
+        throw std::invalid_argument(std::string(ctx) + opus_strerror(err));
+    }
+}
+
+class OpusFileSource : public AudioSource
+{
+public:
+    explicit OpusFileSource(const std::string &name)
+    {
+        int err = 0;
+        file = op_open_file(name.c_str(), &err);
+        if (file == nullptr)
+        {
+            throw std::invalid_argument("Could not open " + name);
+        }
+    }
+    ~OpusFileSource()
+    {
+        op_free(file);
+    }
+
+    size_t read(float *dst, size_t len) override
+    {
+        int res = op_read_float(file, dst, len, NULL);
+        throwIfOpus("Failure reading data!", res);
+        return res;
+    }
+    size_t read(int16_t *dst, size_t len) override
+    {
+        int res = op_read(file, dst, len, NULL);
+        throwIfOpus("Failure reading data!", res);
+        return res;
+    }
+
+private:
+    OggOpusFile *file = nullptr;
+};
+
+// Ogg Opus or raw s16le 48khz mono samples
+std::vector<int16_t> readAll(const char *name, const char *what)
+{
+    std::unique_ptr<AudioSource> source;
+    try
+    {
+        source = open_audio_source<OpusFileSource>(name);
+    }
+    catch (std::invalid_argument &)
+    {
+        throw std::invalid_argument(std::string("Could not open ") + what + " file!");
+    }
+
+    std::vector<int16_t> buffer = source->read_all<int16_t>();
+    if (buffer.empty())
+    {
+        throw std::invalid_argument("Read no data!");
+    }
+    return buffer;
+}
+
 int main(int argc, char **argv)
 {
     if (argc < 3)
@@ -47,7 +115,13 @@ int main(int argc, char **argv)
 
     try
     {
-        Rater rater(argv[0], argv[1], argv[2], argc == 4 ? argv[3] : nullptr);
+        std::vector<int16_t> orig = readAll(argv[1], "original");
+        std::vector<int16_t> mod = readAll(argv[2], "modified");
+
+        std::filesystem::path modelDir = std::filesystem::canonical(argv[0]).parent_path();
+        modelDir += "/src/assets/model";
+
+        Rater rater(modelDir, orig.data(), orig.size(), mod.data(), mod.size(), argc == 4 ? argv[3] : nullptr);
         std::cout << rater.finalRateWeight() << std::endl;
     }
     catch (std::invalid_argument &exception)
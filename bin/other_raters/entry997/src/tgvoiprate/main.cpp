@@ -1,184 +1,62 @@
-#include <complex>
 #include <iomanip>
 #include <iostream>
+#include <memory>
 #include <opusfile.h>
-#include <valarray>
+#include <stdexcept>
 #include <vector>
 
-typedef std::complex<double> ComplexVal;
-typedef std::valarray<ComplexVal> SampleArray;
+#include "audio_source.h"
+#include "estimator.h"
 
-void FFT(SampleArray& values) {
-    const size_t N = values.size();
-    if (N <= 1)
-        return;
-
-    SampleArray evens = values[std::slice(0, N / 2, 2)];
-    SampleArray odds = values[std::slice(1, N / 2, 2)];
-
-    FFT(evens);
-    FFT(odds);
-
-    for (size_t i = 0; i < N / 2; i++) {
-        ComplexVal index = std::polar(1.0, -2 * M_PI * i / N) * odds[i];
-        values[i] = evens[i] + index;
-        values[i + N / 2] = evens[i] - index;
-    }
-}
-
-class Estimator {
+class OpusAudioSource : public AudioSource {
 private:
-    static const size_t frame_size = 1024;
-    constexpr static const double silence_border = 1e-2;
-    static double window[frame_size];
-    OggOpusFile *ref;
-    OggOpusFile *tst;
-    float buf[frame_size];
-    SampleArray fft;
-    double spectre[frame_size / 2];
-    size_t ref_frames;
-    size_t ref_silence;
-    double final_ref_spectre[frame_size / 2];
-    size_t tst_frames;
-    size_t tst_silence;
-    double final_tst_spectre[frame_size / 2];
+    OggOpusFile *file;
 
 public:
-    Estimator(const char *ref_file, const char *tst_file)
-    : ref(nullptr)
-    , tst(nullptr)
-    , buf()
-    , fft(frame_size)
-    , spectre()
-    , ref_frames(0)
-    , ref_silence(0)
-    , final_ref_spectre()
-    , tst_frames(0)
-    , tst_silence(0)
-    , final_tst_spectre()
-    {
+    using AudioSource::read;
+
+    explicit OpusAudioSource(const std::string &path) {
         int err;
-        ref = op_open_file(ref_file, &err);
-        if (err) {
-            close_files();
-            throw std::invalid_argument("Can't open the reference file");
-        }
-        tst = op_open_file(tst_file, &err);
+        file = op_open_file(path.c_str(), &err);
         if (err) {
-            close_files();
-            throw std::invalid_argument("Can't open the test file");
+            if (file)
+                op_free(file);
+            throw std::invalid_argument("Can't open " + path);
         }
     }
 
-    ~Estimator() {
-        close_files();
+    ~OpusAudioSource() {
+        op_free(file);
     }
 
-    double evaluate() {
-        evaluate_ref();
-        evaluate_tst();
-
-        double trail_ratio = (.0 + tst_frames - tst_silence) / (.0 + ref_frames - ref_silence);
-        std::vector<double> spectre_eval;
-        for (size_t i = 0; i < frame_size / 2 / 20; ++i)
-            if (final_ref_spectre[i] >= final_tst_spectre[i])
-                spectre_eval.push_back(final_tst_spectre[i] / final_ref_spectre[i]);
-        std::sort(spectre_eval.begin(), spectre_eval.end());
-        double spectre_est = spectre_eval.empty() ? 0 : spectre_eval[spectre_eval.size() / 2];
-        double trail_est = std::pow(trail_ratio < 1 ? trail_ratio : 1 / trail_ratio, 3);
-
-        double final_est = 1.5 * trail_est + 3.5 * spectre_est;
-        final_est = std::min(5.0, std::max(1.0, final_est));
-        return final_est;
-    }
-
-    static void init_hanning_window() {
-        double frame_size_minus1 = frame_size - 1;
-        for (size_t i = 0; i < frame_size; ++i)
-            window[i] = 0.5 * (1 - cos (2. * M_PI * (i / frame_size_minus1)));
-    }
-
-private:
-    void close_files() {
-        if (ref) {
-            op_free(ref);
-            ref = nullptr;
-        }
-        if (tst) {
-            op_free(tst);
-            tst = nullptr;
-        }
-    }
-
-    bool read_frame(OggOpusFile *decoder) {
-        int read, remains = frame_size;
-        while (remains > 0 && (read = op_read_float(decoder, buf + frame_size - remains, remains, nullptr)) > 0)
-            remains -= read;
-        return remains == 0;
-    }
-
-    void calc_fft() {
-        for (size_t i = 0; i < frame_size; ++i)
-            fft[i] = ComplexVal(buf[i], 0) * window[i];
-        FFT(fft);
-    }
-
-    void calc_spectre() {
-        calc_fft();
-        for (size_t i = 0; i < frame_size / 2; ++i)
-            spectre[i] = std::abs(fft[i]);
-    }
-
-    bool is_silence() {
-        for (double amp : buf)
-            if (std::abs(amp) > silence_border)
-                return false;
-        return true;
+    size_t read(float *dst, size_t len) override {
+        int read = op_read_float(file, dst, len, nullptr);
+        return read > 0 ? read : 0;
     }
+};
 
-    void evaluate_ref() {
-        op_raw_seek(ref, 0);
-        ref_frames = 0;
-        ref_silence = 0;
-        while (read_frame(ref)) {
-            ++ref_frames;
-            if (is_silence())
-                ++ref_silence;
-            calc_spectre();
-            for (size_t i = 0; i < frame_size / 2; ++i)
-                final_ref_spectre[i] += spectre[i];
-        }
+// Ogg Opus or raw s16le PCM
+std::vector<float> read_all(const char *path, const char *what) {
+    std::unique_ptr<AudioSource> source;
+    try {
+        source = open_audio_source<OpusAudioSource>(path);
     }
-
-    void evaluate_tst() {
-        op_raw_seek(tst, 0);
-        tst_frames = 0;
-        tst_silence = 0;
-        while (read_frame(tst)) {
-            if (is_silence()) {
-                if (tst_frames > ref_frames)
-                    break;
-                ++tst_silence;
-            }
-            ++tst_frames;
-            calc_spectre();
-            for (size_t i = 0; i < frame_size / 2; ++i)
-                final_tst_spectre[i] += spectre[i];
-        }
+    catch (std::invalid_argument &) {
+        throw std::invalid_argument(std::string("Can't open the ") + what + " file");
     }
-};
-
-double Estimator::window[] = {1};
+    return source->read_all<float>();
+}
 
 int main(int argc, char *argv[]) {
     if (argc != 3) {
-        std::cerr << "Usage: tgvoiprate reference.ogg test.ogg" << std::endl;
+        std::cerr << "Usage: tgvoiprate reference.{ogg,pcm} test.{ogg,pcm}" << std::endl;
         return 1;
     }
 
-    Estimator::init_hanning_window();
     try {
-        Estimator estimator(argv[1], argv[2]);
+        std::vector<float> ref = read_all(argv[1], "reference");
+        std::vector<float> tst = read_all(argv[2], "test");
+        entry997::Estimator estimator(ref, tst);
         std::cout << estimator.evaluate() << std::endl;
     }
     catch (std::exception &err) {
@@ -187,4 +65,4 @@ int main(int argc, char *argv[]) {
     }
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "pcm_source.h"
+
+// Decoded mono 48 kHz input of the raters in bin/other_raters. Each rater
+// implements it over its own Ogg Opus decoder; raw PCM goes through
+// PcmAudioSource, so ratings don't need an ffmpeg transcoding step.
+class AudioSource {
+public:
+    virtual ~AudioSource() {}
+
+    // Reads up to `len` samples scaled to [-1, 1) and returns the number
+    // read, 0 at the end of the input.
+    virtual size_t read(float *dst, size_t len) = 0;
+
+    // The same as 16-bit samples. Decoders with a native integer output
+    // override it; the default converts the float samples.
+    virtual size_t read(int16_t *dst, size_t len) {
+        float buf[4096];
+        size_t total = 0;
+        while (total < len) {
+            size_t got = read(buf, std::min(len - total, sizeof(buf) / sizeof(buf[0])));
+            if (got == 0)
+                break;
+            for (size_t i = 0; i < got; ++i)
+                dst[total + i] = (int16_t) std::max(-32768.f, std::min(32767.f, std::round(buf[i] * 32768.f)));
+            total += got;
+        }
+        return total;
+    }
+
+    template <typename T>
+    std::vector<T> read_all() {
+        std::vector<T> samples;
+        T buf[5760];
+        size_t got;
+        while ((got = read(buf, sizeof(buf) / sizeof(buf[0]))) > 0)
+            samples.insert(samples.end(), buf, buf + got);
+        return samples;
+    }
+};
+
+// Raw s16le samples, mapped in place by PcmSource.
+class PcmAudioSource : public AudioSource {
+private:
+    PcmSource source;
+
+public:
+    explicit PcmAudioSource(const std::string &path)
+    : source(path)
+    {
+    }
+
+    size_t read(float *dst, size_t len) override {
+        const int16_t *samples = source.next(len);
+        for (size_t i = 0; i < len; ++i)
+            dst[i] = samples[i] / 32768.f;
+        return len;
+    }
+
+    size_t read(int16_t *dst, size_t len) override {
+        return source.read(dst, len);
+    }
+};
+
+// Ogg files start with "OggS"; everything else, including pipes and stdin
+// ("-"), is taken for raw PCM.
+inline bool is_ogg_file(const std::string &path) {
+    struct stat st;
+    if (path == "-" || stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+        return false;
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file)
+        return false;
+    char magic[4] = {};
+    bool ogg = fread(magic, 1, sizeof(magic), file) == sizeof(magic) && memcmp(magic, "OggS", sizeof(magic)) == 0;
+    fclose(file);
+    return ogg;
+}
+
+// Opens `path` with the rater's Ogg Opus source type, or as raw PCM.
+template <typename OggSource>
+std::unique_ptr<AudioSource> open_audio_source(const std::string &path) {
+    if (is_ogg_file(path))
+        return std::unique_ptr<AudioSource>(new OggSource(path));
+    return std::unique_ptr<AudioSource>(new PcmAudioSource(path));
+}
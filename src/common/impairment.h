@@ -0,0 +1,385 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Deterministic userspace replacement for the netem/tbf chains CallTester
+// builds. Profiles use the same words as tc:
+//
+//   loss P% [C%]                     correlated loss
+//   loss gemodel p% [r% [1-h% [1-k%]]] Gilbert-Elliott loss
+//   delay Dms [Jms [C%]] [distribution normal]
+//   reorder P% [C%]                  send P% of packets without delay
+//   duplicate P% [C%]
+//   rate R{bit|kbit|mbit} [buffer B] [limit L]   token bucket (tbf)
+//
+// All randomness comes from a seeded generator, so a given seed and packet
+// sequence always produces the same schedule.
+namespace impairment {
+
+struct Profile {
+    // Gilbert-Elliott: p = P(good -> bad), r = P(bad -> good),
+    // loss probability 1 - k in the good and 1 - h in the bad state.
+    bool has_loss = false;
+    double ge_p = 0;
+    double ge_r = 1;
+    double ge_loss_good = 0;
+    double ge_loss_bad = 1;
+
+    double delay_ms = 0;
+    double jitter_ms = 0;
+    double delay_correlation = 0;
+
+    double reorder = 0;
+    double reorder_correlation = 0;
+
+    double duplicate = 0;
+    double duplicate_correlation = 0;
+
+    double rate_bps = 0;
+    double buffer_bytes = 1600;
+    double limit_bytes = 3000;
+};
+
+// One profile of a schedule, active from `start_ms` after the flow started.
+struct Stage {
+    uint64_t start_ms = 0;
+    Profile profile;
+};
+
+inline double parse_percent(const std::string &token) {
+    return std::strtod(token.c_str(), nullptr) / 100;
+}
+
+inline double parse_ms(const std::string &token) {
+    char *end = nullptr;
+    double value = std::strtod(token.c_str(), &end);
+    std::string unit(end);
+    if (unit == "s")
+        return value * 1000;
+    if (unit == "us")
+        return value / 1000;
+    return value;
+}
+
+inline double parse_rate(const std::string &token) {
+    char *end = nullptr;
+    double value = std::strtod(token.c_str(), &end);
+    std::string unit(end);
+    if (unit == "kbit")
+        return value * 1000;
+    if (unit == "mbit")
+        return value * 1000000;
+    if (unit == "bit" || unit.empty())
+        return value;
+    throw std::invalid_argument("Unknown rate unit: " + token);
+}
+
+inline bool is_number(const std::string &token) {
+    return !token.empty() && (isdigit(static_cast<unsigned char>(token[0])) || token[0] == '.');
+}
+
+inline Profile parse_profile(const std::string &spec) {
+    std::istringstream stream(spec);
+    std::vector<std::string> tokens;
+    std::string token;
+    while (stream >> token)
+        tokens.push_back(token);
+
+    Profile profile;
+    size_t i = 0;
+    auto optional = [&](double &value, double (*parse)(const std::string &)) {
+        if (i < tokens.size() && is_number(tokens[i]))
+            value = parse(tokens[i++]);
+    };
+    while (i < tokens.size()) {
+        const std::string word = tokens[i++];
+        if (word == "loss") {
+            profile.has_loss = true;
+            if (i < tokens.size() && tokens[i] == "gemodel") {
+                // Defaults as in netem: r = 1 - p, 1 - h = 100%, 1 - k = 0%.
+                ++i;
+                profile.ge_p = 0;
+                optional(profile.ge_p, parse_percent);
+                profile.ge_r = 1 - profile.ge_p;
+                optional(profile.ge_r, parse_percent);
+                profile.ge_loss_bad = 1;
+                optional(profile.ge_loss_bad, parse_percent);
+                profile.ge_loss_good = 0;
+                optional(profile.ge_loss_good, parse_percent);
+            } else {
+                // Correlated loss as a two-state chain with mean loss P and
+                // P(loss | previous loss) = C + (1 - C) * P, which is plain
+                // Bernoulli loss for C = 0.
+                double loss = 0, correlation = 0;
+                optional(loss, parse_percent);
+                optional(correlation, parse_percent);
+                double stay_bad = correlation + (1 - correlation) * loss;
+                profile.ge_r = 1 - stay_bad;
+                profile.ge_p = loss >= 1 ? 1 : loss * profile.ge_r / (1 - loss);
+                profile.ge_loss_good = 0;
+                profile.ge_loss_bad = 1;
+            }
+        } else if (word == "delay") {
+            optional(profile.delay_ms, parse_ms);
+            optional(profile.jitter_ms, parse_ms);
+            optional(profile.delay_correlation, parse_percent);
+        } else if (word == "distribution") {
+            if (i < tokens.size() && tokens[i] != "normal")
+                throw std::invalid_argument("Only the normal delay distribution is supported");
+            ++i;
+        } else if (word == "reorder") {
+            optional(profile.reorder, parse_percent);
+            optional(profile.reorder_correlation, parse_percent);
+        } else if (word == "duplicate") {
+            optional(profile.duplicate, parse_percent);
+            optional(profile.duplicate_correlation, parse_percent);
+        } else if (word == "rate") {
+            if (i >= tokens.size())
+                throw std::invalid_argument("Missing rate value");
+            profile.rate_bps = parse_rate(tokens[i++]);
+        } else if (word == "buffer" || word == "burst") {
+            if (i >= tokens.size())
+                throw std::invalid_argument("Missing buffer size");
+            profile.buffer_bytes = std::strtod(tokens[i++].c_str(), nullptr);
+        } else if (word == "limit") {
+            if (i >= tokens.size())
+                throw std::invalid_argument("Missing limit");
+            profile.limit_bytes = std::strtod(tokens[i++].c_str(), nullptr);
+        } else {
+            throw std::invalid_argument("Unknown impairment: " + word);
+        }
+    }
+    return profile;
+}
+
+// "T:spec" starts at T seconds, a bare spec at 0.
+inline Stage parse_stage(const std::string &text) {
+    Stage stage;
+    size_t colon = text.find(':');
+    std::string spec = text;
+    if (colon != std::string::npos && is_number(text.substr(0, colon))) {
+        stage.start_ms = static_cast<uint64_t>(std::strtod(text.c_str(), nullptr) * 1000);
+        spec = text.substr(colon + 1);
+    }
+    stage.profile = parse_profile(spec);
+    return stage;
+}
+
+// splitmix64 with its own uniform and normal draws, so schedules are
+// identical across standard libraries.
+class Random {
+private:
+    uint64_t state;
+    bool has_spare;
+    double spare;
+
+public:
+    explicit Random(uint64_t seed)
+    : state(seed ^ 0x9e3779b97f4a7c15ULL)
+    , has_spare(false)
+    , spare(0)
+    {
+        for (int i = 0; i < 4; ++i)
+            next();
+    }
+
+    uint64_t next() {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+    double uniform() {
+        return (next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+    double normal() {
+        if (has_spare) {
+            has_spare = false;
+            return spare;
+        }
+        double u1, u2;
+        do {
+            u1 = uniform();
+        } while (u1 <= 0);
+        u2 = uniform();
+        double radius = std::sqrt(-2 * std::log(u1));
+        spare = radius * std::sin(2 * M_PI * u2);
+        has_spare = true;
+        return radius * std::cos(2 * M_PI * u2);
+    }
+};
+
+// netem-style correlated Bernoulli draw.
+class Correlated {
+private:
+    double last;
+
+public:
+    Correlated() : last(0) {}
+
+    bool draw(Random &random, double probability, double correlation) {
+        if (probability <= 0)
+            return false;
+        double value = random.uniform();
+        value = correlation * last + (1 - correlation) * value;
+        last = value;
+        return value < probability;
+    }
+};
+
+// Impairment state of one direction of one flow. For each packet,
+// schedule() returns the send times (0, 1 or 2 of them) in milliseconds.
+class Channel {
+private:
+    std::vector<Stage> stages;
+    Random random;
+    bool bad_state;
+    double delay_state;
+    Correlated reorder_draw;
+    Correlated duplicate_draw;
+    double bucket_tat_ms;
+
+    const Profile &profile_at(uint64_t elapsed_ms) const {
+        size_t current = 0;
+        for (size_t i = 0; i < stages.size(); ++i)
+            if (stages[i].start_ms <= elapsed_ms)
+                current = i;
+        return stages[current].profile;
+    }
+
+    bool lost(const Profile &profile) {
+        if (!profile.has_loss)
+            return false;
+        if (bad_state)
+            bad_state = random.uniform() >= profile.ge_r;
+        else
+            bad_state = random.uniform() < profile.ge_p;
+        double loss = bad_state ? profile.ge_loss_bad : profile.ge_loss_good;
+        return loss > 0 && random.uniform() < loss;
+    }
+
+    double delay(const Profile &profile) {
+        if (profile.jitter_ms <= 0)
+            return profile.delay_ms;
+        double c = profile.delay_correlation;
+        delay_state = c * delay_state + std::sqrt(1 - c * c) * random.normal();
+        return std::max(0.0, profile.delay_ms + profile.jitter_ms * delay_state);
+    }
+
+    // Token bucket in virtual time (GCRA). Returns false when the packet
+    // would overflow the queue limit.
+    bool shape(const Profile &profile, double &time_ms, size_t size) {
+        if (profile.rate_bps <= 0)
+            return true;
+        double ms_per_byte = 8000.0 / profile.rate_bps;
+        double burst_ms = profile.buffer_bytes * ms_per_byte;
+        double departure = std::max(time_ms, bucket_tat_ms - burst_ms);
+        double backlog_bytes = (departure - time_ms) / ms_per_byte;
+        if (backlog_bytes + size > profile.limit_bytes)
+            return false;
+        bucket_tat_ms = std::max(bucket_tat_ms, time_ms) + size * ms_per_byte;
+        time_ms = departure;
+        return true;
+    }
+
+public:
+    Channel(const std::vector<Stage> &stages, uint64_t seed)
+    : stages(stages.empty() ? std::vector<Stage>{Stage()} : stages)
+    , random(seed)
+    , bad_state(false)
+    , delay_state(0)
+    , bucket_tat_ms(0)
+    {
+    }
+
+    // `now_ms` is the arrival time, `start_ms` the arrival of the flow's
+    // first packet (stages are relative to it).
+    size_t schedule(uint64_t now_ms, uint64_t start_ms, size_t size, double out[2]) {
+        const Profile &profile = profile_at(now_ms - start_ms);
+        if (lost(profile))
+            return 0;
+        size_t copies = duplicate_draw.draw(random, profile.duplicate, profile.duplicate_correlation) ? 2 : 1;
+        size_t sent = 0;
+        for (size_t i = 0; i < copies; ++i) {
+            double time_ms = now_ms;
+            if (!reorder_draw.draw(random, profile.reorder, profile.reorder_correlation))
+                time_ms += delay(profile);
+            if (shape(profile, time_ms, size))
+                out[sent++] = time_ms;
+        }
+        return sent;
+    }
+};
+
+// Hashed timer wheel with 1 ms slots: inserting and expiring an item costs
+// O(1). Items further away than one revolution stay in their slot until
+// their round comes up.
+template <typename T>
+class TimerWheel {
+private:
+    struct Entry {
+        uint64_t due_ms;
+        T item;
+    };
+
+    std::vector<std::vector<Entry>> slots;
+    uint64_t current_ms;
+    size_t pending;
+
+public:
+    explicit TimerWheel(size_t slot_count = 8192, uint64_t start_ms = 0)
+    : slots(slot_count)
+    , current_ms(start_ms)
+    , pending(0)
+    {
+    }
+
+    size_t size() const {
+        return pending;
+    }
+
+    void insert(uint64_t due_ms, const T &item) {
+        if (due_ms < current_ms)
+            due_ms = current_ms;
+        slots[due_ms % slots.size()].push_back({due_ms, item});
+        ++pending;
+    }
+
+    // Calls `fire(item)` for every item due up to and including `now_ms`,
+    // in due order (insertion order within a millisecond).
+    template <typename F>
+    void advance(uint64_t now_ms, F fire) {
+        while (current_ms <= now_ms) {
+            std::vector<Entry> &slot = slots[current_ms % slots.size()];
+            if (!slot.empty()) {
+                size_t kept = 0;
+                for (size_t i = 0; i < slot.size(); ++i) {
+                    if (slot[i].due_ms <= current_ms) {
+                        --pending;
+                        fire(slot[i].item);
+                    } else {
+                        slot[kept++] = slot[i];
+                    }
+                }
+                slot.resize(kept);
+            }
+            if (pending == 0) {
+                current_ms = now_ms + 1;
+                break;
+            }
+            ++current_ms;
+        }
+    }
+};
+
+}
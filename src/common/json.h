@@ -0,0 +1,363 @@
+#pragma once
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Minimal JSON document model for the spec and config files of the test
+// tools. Parsing errors throw std::invalid_argument.
+namespace json {
+
+class Value {
+public:
+    enum class Type { Null, Bool, Number, String, Array, Object };
+
+    Value() : type_(Type::Null), boolean(false), number(0) {}
+    Value(bool value) : type_(Type::Bool), boolean(value), number(0) {}
+    template <typename T, typename = typename std::enable_if<
+        std::is_arithmetic<T>::value && !std::is_same<T, bool>::value>::type>
+    Value(T value) : type_(Type::Number), boolean(false), number(static_cast<double>(value)) {}
+    Value(const char *value) : type_(Type::String), boolean(false), number(0), string(value) {}
+    Value(const std::string &value) : type_(Type::String), boolean(false), number(0), string(value) {}
+
+    static Value array() {
+        Value value;
+        value.type_ = Type::Array;
+        return value;
+    }
+
+    static Value object() {
+        Value value;
+        value.type_ = Type::Object;
+        return value;
+    }
+
+    Type type() const { return type_; }
+    bool is_null() const { return type_ == Type::Null; }
+    bool is_string() const { return type_ == Type::String; }
+    bool is_number() const { return type_ == Type::Number; }
+    bool is_array() const { return type_ == Type::Array; }
+    bool is_object() const { return type_ == Type::Object; }
+
+    bool as_bool() const {
+        expect(Type::Bool, "boolean");
+        return boolean;
+    }
+
+    double as_number() const {
+        expect(Type::Number, "number");
+        return number;
+    }
+
+    const std::string &as_string() const {
+        expect(Type::String, "string");
+        return string;
+    }
+
+    // Scalars as command-line style text: numbers without a trailing ".0",
+    // booleans as "yes"/"no".
+    std::string to_text() const {
+        switch (type_) {
+            case Type::String:
+                return string;
+            case Type::Bool:
+                return boolean ? "yes" : "no";
+            case Type::Number: {
+                char buf[32];
+                if (number == std::floor(number) && std::fabs(number) < 1e15)
+                    snprintf(buf, sizeof(buf), "%lld", (long long) number);
+                else
+                    snprintf(buf, sizeof(buf), "%.17g", number);
+                return buf;
+            }
+            default:
+                throw std::invalid_argument("JSON value is not a scalar");
+        }
+    }
+
+    const std::vector<Value> &items() const {
+        expect(Type::Array, "array");
+        return elements;
+    }
+
+    const std::map<std::string, Value> &members() const {
+        expect(Type::Object, "object");
+        return fields;
+    }
+
+    bool has(const std::string &key) const {
+        return type_ == Type::Object && fields.count(key) != 0;
+    }
+
+    const Value &operator[](const std::string &key) const {
+        expect(Type::Object, "object");
+        auto it = fields.find(key);
+        if (it == fields.end())
+            throw std::invalid_argument("Missing JSON key: " + key);
+        return it->second;
+    }
+
+    Value &set(const std::string &key, const Value &value) {
+        expect(Type::Object, "object");
+        return fields[key] = value;
+    }
+
+    Value &push(const Value &value) {
+        expect(Type::Array, "array");
+        elements.push_back(value);
+        return elements.back();
+    }
+
+    std::string dump() const {
+        std::string out;
+        dump(out);
+        return out;
+    }
+
+private:
+    Type type_;
+    bool boolean;
+    double number;
+    std::string string;
+    std::vector<Value> elements;
+    std::map<std::string, Value> fields;
+
+    friend class Parser;
+
+    void expect(Type type, const char *name) const {
+        if (type_ != type)
+            throw std::invalid_argument(std::string("JSON value is not a ") + name);
+    }
+
+    static void dump_string(const std::string &value, std::string &out) {
+        out += '"';
+        for (unsigned char c : value) {
+            switch (c) {
+                case '"': out += "\\\""; break;
+                case '\\': out += "\\\\"; break;
+                case '\n': out += "\\n"; break;
+                case '\r': out += "\\r"; break;
+                case '\t': out += "\\t"; break;
+                default:
+                    if (c < 0x20) {
+                        char buf[8];
+                        snprintf(buf, sizeof(buf), "\\u%04x", c);
+                        out += buf;
+                    } else {
+                        out += c;
+                    }
+            }
+        }
+        out += '"';
+    }
+
+    void dump(std::string &out) const {
+        switch (type_) {
+            case Type::Null:
+                out += "null";
+                break;
+            case Type::Bool:
+                out += boolean ? "true" : "false";
+                break;
+            case Type::Number:
+                out += to_text();
+                break;
+            case Type::String:
+                dump_string(string, out);
+                break;
+            case Type::Array: {
+                out += '[';
+                for (size_t i = 0; i < elements.size(); ++i) {
+                    if (i)
+                        out += ',';
+                    elements[i].dump(out);
+                }
+                out += ']';
+                break;
+            }
+            case Type::Object: {
+                out += '{';
+                bool first = true;
+                for (const auto &field : fields) {
+                    if (!first)
+                        out += ',';
+                    first = false;
+                    dump_string(field.first, out);
+                    out += ':';
+                    field.second.dump(out);
+                }
+                out += '}';
+                break;
+            }
+        }
+    }
+};
+
+class Parser {
+private:
+    const std::string &text;
+    size_t pos;
+
+    [[noreturn]] void fail(const char *what) const {
+        throw std::invalid_argument(std::string("JSON parse error at offset ") + std::to_string(pos) + ": " + what);
+    }
+
+    void skip_spaces() {
+        while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\n' || text[pos] == '\r'))
+            ++pos;
+    }
+
+    bool consume(const char *literal) {
+        size_t len = std::char_traits<char>::length(literal);
+        if (text.compare(pos, len, literal) != 0)
+            return false;
+        pos += len;
+        return true;
+    }
+
+    static void append_utf8(unsigned code, std::string &out) {
+        if (code < 0x80) {
+            out += static_cast<char>(code);
+        } else if (code < 0x800) {
+            out += static_cast<char>(0xc0 | (code >> 6));
+            out += static_cast<char>(0x80 | (code & 0x3f));
+        } else {
+            out += static_cast<char>(0xe0 | (code >> 12));
+            out += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+            out += static_cast<char>(0x80 | (code & 0x3f));
+        }
+    }
+
+    std::string parse_string() {
+        if (text[pos] != '"')
+            fail("expected string");
+        ++pos;
+        std::string out;
+        while (pos < text.size() && text[pos] != '"') {
+            char c = text[pos++];
+            if (c != '\\') {
+                out += c;
+                continue;
+            }
+            if (pos >= text.size())
+                fail("unterminated escape");
+            c = text[pos++];
+            switch (c) {
+                case '"': out += '"'; break;
+                case '\\': out += '\\'; break;
+                case '/': out += '/'; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'n': out += '\n'; break;
+                case 'r': out += '\r'; break;
+                case 't': out += '\t'; break;
+                case 'u': {
+                    if (pos + 4 > text.size())
+                        fail("bad unicode escape");
+                    append_utf8(std::stoul(text.substr(pos, 4), nullptr, 16), out);
+                    pos += 4;
+                    break;
+                }
+                default:
+                    fail("bad escape");
+            }
+        }
+        if (pos >= text.size())
+            fail("unterminated string");
+        ++pos;
+        return out;
+    }
+
+    Value parse_value() {
+        skip_spaces();
+        if (pos >= text.size())
+            fail("unexpected end");
+        char c = text[pos];
+        if (c == '{') {
+            ++pos;
+            Value value = Value::object();
+            skip_spaces();
+            if (pos < text.size() && text[pos] == '}') {
+                ++pos;
+                return value;
+            }
+            while (true) {
+                skip_spaces();
+                std::string key = parse_string();
+                skip_spaces();
+                if (pos >= text.size() || text[pos++] != ':')
+                    fail("expected ':'");
+                value.fields[key] = parse_value();
+                skip_spaces();
+                if (pos < text.size() && text[pos] == ',') {
+                    ++pos;
+                    continue;
+                }
+                if (pos < text.size() && text[pos] == '}') {
+                    ++pos;
+                    return value;
+                }
+                fail("expected ',' or '}'");
+            }
+        }
+        if (c == '[') {
+            ++pos;
+            Value value = Value::array();
+            skip_spaces();
+            if (pos < text.size() && text[pos] == ']') {
+                ++pos;
+                return value;
+            }
+            while (true) {
+                value.elements.push_back(parse_value());
+                skip_spaces();
+                if (pos < text.size() && text[pos] == ',') {
+                    ++pos;
+                    continue;
+                }
+                if (pos < text.size() && text[pos] == ']') {
+                    ++pos;
+                    return value;
+                }
+                fail("expected ',' or ']'");
+            }
+        }
+        if (c == '"')
+            return Value(parse_string());
+        if (consume("true"))
+            return Value(true);
+        if (consume("false"))
+            return Value(false);
+        if (consume("null"))
+            return Value();
+        const char *start = text.c_str() + pos;
+        char *end = nullptr;
+        double number = strtod(start, &end);
+        if (end == start)
+            fail("unexpected character");
+        pos += end - start;
+        return Value(number);
+    }
+
+public:
+    explicit Parser(const std::string &text) : text(text), pos(0) {}
+
+    Value parse() {
+        Value value = parse_value();
+        skip_spaces();
+        if (pos != text.size())
+            fail("trailing characters");
+        return value;
+    }
+};
+
+inline Value parse(const std::string &text) {
+    return Parser(text).parse();
+}
+
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Read-only raw PCM input (s16le, mono) shared by tgvoipcall and tgvoiprate.
+// Regular files are memory-mapped and prefaulted, so samples are consumed in
+// place and reading never issues a syscall. Pipes and stdin ("-") can't be
+// mapped and are read into memory instead.
+class PcmSource {
+private:
+    void *mapping;
+    size_t mapping_size;
+    std::vector<int16_t> buffer;
+    const int16_t *samples;
+    size_t count;
+    size_t position;
+
+    void read_all(int fd) {
+        std::vector<char> bytes;
+        char chunk[65536];
+        while (true) {
+            ssize_t got = ::read(fd, chunk, sizeof(chunk));
+            if (got < 0 && errno == EINTR)
+                continue;
+            if (got < 0)
+                throw std::runtime_error(std::string("Can't read the audio input: ") + strerror(errno));
+            if (got == 0)
+                break;
+            bytes.insert(bytes.end(), chunk, chunk + got);
+        }
+        buffer.resize(bytes.size() / sizeof(int16_t));
+        memcpy(buffer.data(), bytes.data(), buffer.size() * sizeof(int16_t));
+        samples = buffer.data();
+        count = buffer.size();
+    }
+
+public:
+    explicit PcmSource(const std::string &path)
+    : mapping(nullptr)
+    , mapping_size(0)
+    , samples(nullptr)
+    , count(0)
+    , position(0)
+    {
+        bool is_stdin = path == "-";
+        int fd = is_stdin ? STDIN_FILENO : open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::invalid_argument("Can't open the file " + path);
+
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size >= (off_t) sizeof(int16_t)) {
+            int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+            flags |= MAP_POPULATE;
+#endif
+            void *addr = mmap(nullptr, st.st_size, PROT_READ, flags, fd, 0);
+            if (addr != MAP_FAILED) {
+                mapping = addr;
+                mapping_size = st.st_size;
+                madvise(mapping, mapping_size, MADV_SEQUENTIAL);
+                madvise(mapping, mapping_size, MADV_WILLNEED);
+                samples = static_cast<const int16_t *>(mapping);
+                count = mapping_size / sizeof(int16_t);
+            }
+        }
+
+        try {
+            if (!mapping)
+                read_all(fd);
+        }
+        catch (...) {
+            if (!is_stdin)
+                close(fd);
+            throw;
+        }
+        if (!is_stdin)
+            close(fd);
+    }
+
+    ~PcmSource() {
+        if (mapping)
+            munmap(mapping, mapping_size);
+    }
+
+    PcmSource(const PcmSource &) = delete;
+    PcmSource &operator=(const PcmSource &) = delete;
+
+    const int16_t *data() const {
+        return samples;
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    // Copies up to `len` samples from the read position into `dst` and
+    // advances it. Returns the number of samples copied.
+    size_t read(int16_t *dst, size_t len) {
+        size_t n = std::min(len, count - position);
+        memcpy(dst, samples + position, n * sizeof(int16_t));
+        position += n;
+        return n;
+    }
+
+    // Returns a pointer to up to `len` samples at the read position without
+    // copying them and advances it; `len` is updated to the available count.
+    const int16_t *next(size_t &len) {
+        len = std::min(len, count - position);
+        const int16_t *span = samples + position;
+        position += len;
+        return span;
+    }
+
+    void rewind() {
+        position = 0;
+    }
+};
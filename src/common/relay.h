@@ -0,0 +1,264 @@
+#pragma once
+
+#include <arpa/inet.h>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <netinet/in.h>
+
+#include "json.h"
+
+// Call switching and connection parameters of the Telegram UDP relays,
+// shared by tgvoipreflector, the in-process relay of tgvoipcall and
+// tgvoiptest.
+//
+// Every relay packet starts with the 16-byte peer tag of its sender. Tags
+// produced by tgvoipreflector --connection share their first 12 bytes (the
+// call id) between caller and callee, so participants are paired by that
+// prefix, their addresses are learned from the packets they send and each
+// packet goes to the other side with the receiver's tag in front, which is
+// what libtgvoip checks on arrival.
+namespace relay {
+
+const size_t tag_size = 16;
+const size_t call_id_size = 12;
+const size_t max_packet = 2048;
+
+// Special requests carry 12 bytes of 0xff after the tag, then a TL id.
+const uint32_t tlid_udp_ping = 0xfffffffe;
+const uint32_t tlid_self_info = 0xc01572c7;
+
+struct Participant {
+    bool known = false;
+    unsigned char tag[tag_size];
+    sockaddr_in address;
+    uint64_t rx_packets = 0;
+    uint64_t rx_bytes = 0;
+    uint64_t tx_packets = 0;
+    uint64_t tx_bytes = 0;
+};
+
+struct Call {
+    Participant participants[2];
+    time_t last_seen = 0;
+};
+
+// Where handle() wants a packet to go.
+struct Delivery {
+    Participant *from;
+    Participant *to;
+    const unsigned char *data;
+    size_t size;
+};
+
+inline std::string to_hex(const unsigned char *data, size_t size) {
+    static const char digits[] = "0123456789abcdef";
+    std::string hex;
+    for (size_t i = 0; i < size; ++i) {
+        hex += digits[data[i] >> 4];
+        hex += digits[data[i] & 15];
+    }
+    return hex;
+}
+
+inline std::string to_string(const sockaddr_in &address) {
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &address.sin_addr, ip, sizeof(ip));
+    return std::string(ip) + ":" + std::to_string(ntohs(address.sin_port));
+}
+
+inline bool parse_address(const std::string &text, sockaddr_in &address) {
+    size_t colon = text.rfind(':');
+    if (colon == std::string::npos)
+        return false;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    int port = atoi(text.c_str() + colon + 1);
+    if (port <= 0 || port > 65535)
+        return false;
+    address.sin_port = htons(port);
+    return inet_pton(AF_INET, text.substr(0, colon).c_str(), &address.sin_addr) == 1;
+}
+
+class Switch {
+private:
+    std::unordered_map<std::string, Call> calls;
+    unsigned char reply[tag_size + 12 + 4 + 4 + 8 + 16 + 4];
+    bool verbose;
+
+    Participant *find_participant(Call &call, const unsigned char *tag, const sockaddr_in &from) {
+        for (Participant &participant : call.participants) {
+            if (participant.known && memcmp(participant.tag, tag, tag_size) == 0) {
+                participant.address = from;
+                return &participant;
+            }
+        }
+        for (Participant &participant : call.participants) {
+            if (!participant.known) {
+                participant.known = true;
+                memcpy(participant.tag, tag, tag_size);
+                participant.address = from;
+                if (verbose)
+                    std::cerr << "New participant " << to_hex(tag, tag_size) << " from " << to_string(from) << std::endl;
+                return &participant;
+            }
+        }
+        return nullptr;
+    }
+
+    size_t self_info(const Participant &participant, const unsigned char *request, size_t size) {
+        if (size < tag_size + 12 + 4 + 8)
+            return 0;
+        unsigned char *p = reply;
+        memcpy(p, participant.tag, tag_size);
+        p += tag_size;
+        memset(p, 0xff, 12);
+        p += 12;
+        uint32_t tlid = tlid_self_info;
+        memcpy(p, &tlid, 4);
+        p += 4;
+        int32_t date = static_cast<int32_t>(time(nullptr));
+        memcpy(p, &date, 4);
+        p += 4;
+        memcpy(p, request + tag_size + 12 + 4, 8);
+        p += 8;
+        memset(p, 0, 10);
+        memset(p + 10, 0xff, 2);
+        memcpy(p + 12, &participant.address.sin_addr, 4);
+        p += 16;
+        int32_t port = ntohs(participant.address.sin_port);
+        memcpy(p, &port, 4);
+        return sizeof(reply);
+    }
+
+public:
+    explicit Switch(bool verbose = false) : verbose(verbose) {}
+
+    // Routes one packet from `from`. Returns false if there is nothing to
+    // send; otherwise `out` is either the packet rewritten in place for the
+    // other participant or a self-info reply to the sender, valid until the
+    // next call.
+    bool handle(unsigned char *data, size_t size, const sockaddr_in &from, time_t now, Delivery &out) {
+        if (size < tag_size)
+            return false;
+        Call &call = calls[std::string((const char *) data, call_id_size)];
+        call.last_seen = now;
+        Participant *sender = find_participant(call, data, from);
+        if (!sender)
+            return false;
+        ++sender->rx_packets;
+        sender->rx_bytes += size;
+
+        static const unsigned char special[12] = {
+            0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+        };
+        if (size >= tag_size + 12 + 4 && memcmp(data + tag_size, special, 12) == 0) {
+            uint32_t tlid;
+            memcpy(&tlid, data + tag_size + 12, 4);
+            if (tlid != tlid_udp_ping)
+                return false;
+            out = {sender, sender, reply, self_info(*sender, data, size)};
+            return out.size != 0;
+        }
+
+        Participant &receiver = call.participants[sender == &call.participants[0] ? 1 : 0];
+        if (!receiver.known)
+            return false;
+        memcpy(data, receiver.tag, tag_size);
+        out = {sender, &receiver, data, size};
+        return true;
+    }
+
+    static void sent(Participant &participant, size_t size) {
+        ++participant.tx_packets;
+        participant.tx_bytes += size;
+    }
+
+    // Forgets calls idle for longer than `timeout`; returns true if any.
+    bool expire(time_t now, time_t timeout) {
+        bool expired = false;
+        for (auto it = calls.begin(); it != calls.end();) {
+            if (now - it->second.last_seen > timeout) {
+                it = calls.erase(it);
+                expired = true;
+            } else {
+                ++it;
+            }
+        }
+        return expired;
+    }
+
+    // Counters of every participant keyed by its tag. rx is what the relay
+    // received from the participant, tx what it sent to it.
+    json::Value stats() const {
+        json::Value result = json::Value::object();
+        for (const auto &entry : calls) {
+            for (const Participant &participant : entry.second.participants) {
+                if (!participant.known)
+                    continue;
+                json::Value counters = json::Value::object();
+                counters.set("call", to_hex((const unsigned char *) entry.first.data(), call_id_size));
+                counters.set("address", to_string(participant.address));
+                counters.set("rx_packets", participant.rx_packets);
+                counters.set("rx_bytes", participant.rx_bytes);
+                counters.set("tx_packets", participant.tx_packets);
+                counters.set("tx_bytes", participant.tx_bytes);
+                result.set(to_hex(participant.tag, tag_size), counters);
+            }
+        }
+        return result;
+    }
+};
+
+// Connection parameters in the shape of the getConnection API result that
+// CallTester::fetchParams() consumes.
+inline json::Value generate_connection(const sockaddr_in &address) {
+    std::random_device random;
+    auto random_bytes = [&random](unsigned char *out, size_t size) {
+        for (size_t i = 0; i < size; ++i)
+            out[i] = static_cast<unsigned char>(random());
+    };
+
+    unsigned char key[256];
+    random_bytes(key, sizeof(key));
+    unsigned char caller[tag_size];
+    unsigned char callee[tag_size];
+    random_bytes(caller, tag_size);
+    memcpy(callee, caller, call_id_size);
+    do {
+        random_bytes(callee + call_id_size, tag_size - call_id_size);
+    } while (memcmp(caller + call_id_size, callee + call_id_size, tag_size - call_id_size) == 0);
+
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &address.sin_addr, ip, sizeof(ip));
+
+    json::Value tags = json::Value::object();
+    tags.set("caller", to_hex(caller, tag_size));
+    tags.set("callee", to_hex(callee, tag_size));
+    json::Value endpoint = json::Value::object();
+    endpoint.set("ip", ip);
+    endpoint.set("port", ntohs(address.sin_port));
+    endpoint.set("peer_tags", tags);
+    json::Value endpoints = json::Value::array();
+    endpoints.push(endpoint);
+
+    // A non-empty object, so that it survives a PHP json_decode/json_encode
+    // round trip as an object; 60 ms is libtgvoip's default anyway.
+    json::Value config = json::Value::object();
+    config.set("audio_frame_size", 60);
+
+    json::Value result = json::Value::object();
+    result.set("config", config);
+    result.set("encryption_key", to_hex(key, sizeof(key)));
+    result.set("endpoints", endpoints);
+    json::Value response = json::Value::object();
+    response.set("ok", true);
+    response.set("result", result);
+    return response;
+}
+
+}
@@ -0,0 +1,551 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Columnar store of out/ratings.csv for tgvoipresults.
+//
+// A store is a directory with one file per column: Entry, Network and
+// Sample as 32-bit codes into append-only dictionaries, the eight scores as
+// floats. index.bin holds the row count, how far into the CSV the store has
+// read and the running mean/variance of every score per (Entry, Network),
+// so the tables of CallTester::printCsvScores() come from the index alone
+// and importing new CSV rows only touches those rows. index.bin is replaced
+// atomically after the columns are written; anything past its row and
+// dictionary counts is left over from an interrupted import and is cut off
+// on open.
+namespace results {
+
+enum Score {
+    score_combined,
+    score_preprocess,
+    score_output,
+    score_997,
+    score_1010,
+    score_1012,
+    score_1002,
+    score_1007,
+    score_count
+};
+
+const char *const score_columns[score_count] = {
+    "ScoreCombined", "ScorePreprocess", "ScoreOutput",
+    "Score997", "Score1010", "Score1012", "Score1002", "Score1007",
+};
+
+struct Row {
+    std::string entry;
+    std::string network;
+    std::string sample;
+    float scores[score_count];
+};
+
+// Scores outside of [1, 5] are clamped before averaging.
+inline double clamp_score(double score) {
+    return score < 1.0 ? 1.0 : score > 5.0 ? 5.0 : score;
+}
+
+// The weighted score of one rating from clamped scores.
+inline double final_score(const double *clamped) {
+    return clamped[score_combined] * 0.3
+        + std::max(clamped[score_output], clamped[score_997]) * 0.2
+        + clamped[score_1010] * 0.16
+        + clamped[score_1012] * 0.16
+        + clamped[score_1007] * 0.16;
+}
+
+// PHP's floatval(): the longest numeric prefix, 0 if there is none.
+inline float parse_score(const std::string &text) {
+    return static_cast<float>(strtod(text.c_str(), nullptr));
+}
+
+// Running mean and sum of squared deviations (Welford); two of them merge
+// into the moments of both samples.
+struct Moments {
+    uint64_t count = 0;
+    double mean = 0;
+    double m2 = 0;
+
+    void add(double value) {
+        ++count;
+        double delta = value - mean;
+        mean += delta / count;
+        m2 += delta * (value - mean);
+    }
+
+    void merge(const Moments &other) {
+        if (!other.count)
+            return;
+        uint64_t total = count + other.count;
+        double delta = other.mean - mean;
+        mean += delta * other.count / total;
+        m2 += other.m2 + delta * delta * count * other.count / total;
+        count = total;
+    }
+
+    // Sample standard deviation, 0 for a single value.
+    double stddev() const {
+        return count > 1 ? sqrt(m2 / (count - 1)) : 0;
+    }
+};
+
+// Clamped scores of the ratings with one Entry and Network; final_score is
+// Score::score_count.
+struct Cell {
+    Moments scores[score_count + 1];
+
+    void add(const float *row_scores) {
+        double clamped[score_count];
+        for (int i = 0; i < score_count; ++i) {
+            clamped[i] = clamp_score(row_scores[i]);
+            scores[i].add(clamped[i]);
+        }
+        scores[score_count].add(final_score(clamped));
+    }
+
+    void merge(const Cell &other) {
+        for (int i = 0; i <= score_count; ++i)
+            scores[i].merge(other.scores[i]);
+    }
+};
+
+// Values in the order they were first seen.
+class Dictionary {
+private:
+    std::vector<std::string> values;
+    std::unordered_map<std::string, uint32_t> codes;
+
+public:
+    uint32_t code(const std::string &value) {
+        auto it = codes.find(value);
+        if (it != codes.end())
+            return it->second;
+        uint32_t code = static_cast<uint32_t>(values.size());
+        codes.emplace(value, code);
+        values.push_back(value);
+        return code;
+    }
+
+    const std::string &value(uint32_t code) const {
+        return values[code];
+    }
+
+    size_t size() const {
+        return values.size();
+    }
+
+    void clear() {
+        values.clear();
+        codes.clear();
+    }
+};
+
+// Parses the fgetcsv() record starting at `pos` into `fields` and moves
+// `pos` past it. Returns false if `text` ends before the record's newline.
+inline bool parse_csv_record(const std::string &text, size_t &pos, std::vector<std::string> &fields) {
+    fields.clear();
+    size_t i = pos;
+    std::string field;
+    bool quoted_field = false;
+    while (i < text.size()) {
+        char c = text[i];
+        if (c == '"' && field.empty() && !quoted_field) {
+            quoted_field = true;
+            ++i;
+            while (true) {
+                if (i >= text.size())
+                    return false;
+                if (text[i] == '"') {
+                    if (i + 1 >= text.size())
+                        return false;
+                    if (text[i + 1] != '"') {
+                        ++i;
+                        break;
+                    }
+                    ++i;
+                }
+                field += text[i++];
+            }
+        } else if (c == ',') {
+            fields.push_back(field);
+            field.clear();
+            quoted_field = false;
+            ++i;
+        } else if (c == '\n') {
+            if (!field.empty() && field.back() == '\r' && !quoted_field)
+                field.pop_back();
+            fields.push_back(field);
+            pos = i + 1;
+            return true;
+        } else {
+            field += c;
+            ++i;
+        }
+    }
+    return false;
+}
+
+class Store {
+private:
+    static const uint32_t magic = 0x52564754;  // "TGVR"
+    static const uint32_t format_version = 1;
+
+    enum Column { column_entry, column_network, column_sample, code_column_count };
+
+    std::string path;
+    uint64_t row_count = 0;
+    uint64_t csv_offset = 0;
+    std::string csv_header;
+    Dictionary dictionaries[code_column_count];
+    uint64_t dictionary_bytes[code_column_count] = {};
+    std::map<std::pair<uint32_t, uint32_t>, Cell> cells;
+
+    static const char *code_column_name(int column) {
+        static const char *const names[code_column_count] = {"Entry", "Network", "Sample"};
+        return names[column];
+    }
+
+    std::string file(const std::string &name) const {
+        return path + "/" + name;
+    }
+
+    std::string code_file(int column) const {
+        return file(std::string(code_column_name(column)) + ".u32");
+    }
+
+    std::string dictionary_file(int column) const {
+        return file(std::string(code_column_name(column)) + ".dict");
+    }
+
+    std::string score_file(int score) const {
+        return file(std::string(score_columns[score]) + ".f32");
+    }
+
+    static void cut(const std::string &name, uint64_t size) {
+        struct stat st;
+        if (stat(name.c_str(), &st) == 0 && static_cast<uint64_t>(st.st_size) > size
+                && truncate(name.c_str(), static_cast<off_t>(size)) != 0)
+            throw std::runtime_error("Can't truncate " + name + ": " + strerror(errno));
+    }
+
+    template <typename T>
+    static void put(std::string &out, T value) {
+        out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    template <typename T>
+    static T get(const std::string &in, size_t &pos) {
+        if (pos + sizeof(T) > in.size())
+            throw std::runtime_error("Truncated results index");
+        T value;
+        memcpy(&value, in.data() + pos, sizeof(T));
+        pos += sizeof(T);
+        return value;
+    }
+
+    static std::string read_file(const std::string &name) {
+        std::ifstream stream(name, std::ios::binary);
+        return std::string((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+    }
+
+    static void append_file(const std::string &name, const void *data, size_t size) {
+        if (!size)
+            return;
+        FILE *out = fopen(name.c_str(), "ab");
+        if (!out || fwrite(data, 1, size, out) != size || fclose(out) != 0)
+            throw std::runtime_error("Can't write " + name + ": " + strerror(errno));
+    }
+
+    void load() {
+        std::string index = read_file(file("index.bin"));
+        if (index.empty())
+            return;
+        size_t pos = 0;
+        if (get<uint32_t>(index, pos) != magic || get<uint32_t>(index, pos) != format_version)
+            throw std::runtime_error("Not a results store: " + path);
+        row_count = get<uint64_t>(index, pos);
+        csv_offset = get<uint64_t>(index, pos);
+        uint32_t header_size = get<uint32_t>(index, pos);
+        if (pos + header_size > index.size())
+            throw std::runtime_error("Truncated results index");
+        csv_header = index.substr(pos, header_size);
+        pos += header_size;
+
+        for (int column = 0; column < code_column_count; ++column) {
+            uint32_t count = get<uint32_t>(index, pos);
+            dictionary_bytes[column] = get<uint64_t>(index, pos);
+            std::string values = read_file(dictionary_file(column));
+            size_t value_pos = 0;
+            for (uint32_t i = 0; i < count; ++i) {
+                uint32_t size = get<uint32_t>(values, value_pos);
+                if (value_pos + size > values.size())
+                    throw std::runtime_error("Truncated dictionary " + dictionary_file(column));
+                dictionaries[column].code(values.substr(value_pos, size));
+                value_pos += size;
+            }
+        }
+
+        uint32_t cell_count = get<uint32_t>(index, pos);
+        for (uint32_t i = 0; i < cell_count; ++i) {
+            uint32_t entry = get<uint32_t>(index, pos);
+            uint32_t network = get<uint32_t>(index, pos);
+            Cell &cell = cells[{entry, network}];
+            for (Moments &moments : cell.scores) {
+                moments.count = get<uint64_t>(index, pos);
+                moments.mean = get<double>(index, pos);
+                moments.m2 = get<double>(index, pos);
+            }
+        }
+
+        for (int column = 0; column < code_column_count; ++column) {
+            cut(code_file(column), row_count * sizeof(uint32_t));
+            cut(dictionary_file(column), dictionary_bytes[column]);
+        }
+        for (int score = 0; score < score_count; ++score)
+            cut(score_file(score), row_count * sizeof(float));
+    }
+
+    void save_index() const {
+        std::string index;
+        put(index, magic);
+        put(index, format_version);
+        put(index, row_count);
+        put(index, csv_offset);
+        put(index, static_cast<uint32_t>(csv_header.size()));
+        index += csv_header;
+        for (int column = 0; column < code_column_count; ++column) {
+            put(index, static_cast<uint32_t>(dictionaries[column].size()));
+            put(index, dictionary_bytes[column]);
+        }
+        put(index, static_cast<uint32_t>(cells.size()));
+        for (const auto &cell : cells) {
+            put(index, cell.first.first);
+            put(index, cell.first.second);
+            for (const Moments &moments : cell.second.scores) {
+                put(index, moments.count);
+                put(index, moments.mean);
+                put(index, moments.m2);
+            }
+        }
+
+        std::string temporary = file("index.bin.tmp");
+        FILE *out = fopen(temporary.c_str(), "wb");
+        if (!out || fwrite(index.data(), 1, index.size(), out) != index.size() || fclose(out) != 0
+                || rename(temporary.c_str(), file("index.bin").c_str()) != 0)
+            throw std::runtime_error("Can't write " + file("index.bin") + ": " + strerror(errno));
+    }
+
+    // Appends rows to the columns; the index is saved by the caller.
+    void append_columns(const std::vector<Row> &rows) {
+        std::vector<uint32_t> codes[code_column_count];
+        std::vector<float> scores[score_count];
+        std::string new_values[code_column_count];
+        for (const Row &row : rows) {
+            const std::string *values[code_column_count] = {&row.entry, &row.network, &row.sample};
+            for (int column = 0; column < code_column_count; ++column) {
+                size_t known = dictionaries[column].size();
+                uint32_t code = dictionaries[column].code(*values[column]);
+                if (dictionaries[column].size() != known) {
+                    put(new_values[column], static_cast<uint32_t>(values[column]->size()));
+                    new_values[column] += *values[column];
+                }
+                codes[column].push_back(code);
+            }
+            for (int score = 0; score < score_count; ++score)
+                scores[score].push_back(row.scores[score]);
+            cells[{codes[column_entry].back(), codes[column_network].back()}].add(row.scores);
+        }
+
+        for (int column = 0; column < code_column_count; ++column) {
+            append_file(code_file(column), codes[column].data(), codes[column].size() * sizeof(uint32_t));
+            append_file(dictionary_file(column), new_values[column].data(), new_values[column].size());
+            dictionary_bytes[column] += new_values[column].size();
+        }
+        for (int score = 0; score < score_count; ++score)
+            append_file(score_file(score), scores[score].data(), scores[score].size() * sizeof(float));
+        row_count += rows.size();
+    }
+
+    void reset() {
+        for (int column = 0; column < code_column_count; ++column) {
+            unlink(code_file(column).c_str());
+            unlink(dictionary_file(column).c_str());
+            dictionaries[column].clear();
+            dictionary_bytes[column] = 0;
+        }
+        for (int score = 0; score < score_count; ++score)
+            unlink(score_file(score).c_str());
+        unlink(file("index.bin").c_str());
+        row_count = 0;
+        csv_offset = 0;
+        csv_header.clear();
+        cells.clear();
+    }
+
+    template <typename T>
+    std::vector<T> read_column(const std::string &name) const {
+        std::string bytes = read_file(name);
+        std::vector<T> values(row_count);
+        if (bytes.size() < row_count * sizeof(T))
+            throw std::runtime_error("Truncated column " + name);
+        memcpy(values.data(), bytes.data(), row_count * sizeof(T));
+        return values;
+    }
+
+public:
+    // Opens the store in directory `path`, creating it if needed.
+    explicit Store(const std::string &path) : path(path) {
+        if (mkdir(path.c_str(), 0755) != 0 && errno != EEXIST)
+            throw std::runtime_error("Can't create " + path + ": " + strerror(errno));
+        load();
+    }
+
+    uint64_t rows() const {
+        return row_count;
+    }
+
+    const Dictionary &entries() const {
+        return dictionaries[column_entry];
+    }
+
+    const Dictionary &networks() const {
+        return dictionaries[column_network];
+    }
+
+    const Dictionary &samples() const {
+        return dictionaries[column_sample];
+    }
+
+    // Aggregates keyed by (entry code, network code).
+    const std::map<std::pair<uint32_t, uint32_t>, Cell> &aggregates() const {
+        return cells;
+    }
+
+    void append(const std::vector<Row> &rows) {
+        append_columns(rows);
+        save_index();
+    }
+
+    // Imports the rows `csv_path` gained since the last import; starts over
+    // if the file was replaced. A last line without its newline may still
+    // be being written and is left for the next import. Returns the number
+    // of rows imported.
+    uint64_t import_csv(const std::string &csv_path) {
+        std::ifstream csv(csv_path, std::ios::binary);
+        if (!csv)
+            throw std::invalid_argument("CSV file not available: " + csv_path);
+
+        std::string buffer;
+        std::vector<std::string> header;
+        size_t pos = 0;
+        char chunk[1 << 16];
+        auto fill = [&]() {
+            csv.read(chunk, sizeof(chunk));
+            buffer.append(chunk, static_cast<size_t>(csv.gcount()));
+            return csv.gcount() > 0;
+        };
+        while (!parse_csv_record(buffer, pos, header)) {
+            if (!fill())
+                return 0;
+        }
+        std::string header_line = buffer.substr(0, pos);
+
+        csv.clear();
+        csv.seekg(0, std::ios::end);
+        uint64_t csv_size = static_cast<uint64_t>(csv.tellg());
+        if (header_line != csv_header || csv_size < csv_offset) {
+            reset();
+            csv_header = header_line;
+            csv_offset = pos;
+        }
+        csv.seekg(static_cast<std::streamoff>(csv_offset));
+        buffer.clear();
+        pos = 0;
+
+        int entry_column = -1, network_column = -1, sample_column = -1;
+        int score_column[score_count];
+        for (int &column : score_column)
+            column = -1;
+        for (size_t i = 0; i < header.size(); ++i) {
+            if (header[i] == "Entry")
+                entry_column = static_cast<int>(i);
+            else if (header[i] == "Network")
+                network_column = static_cast<int>(i);
+            else if (header[i] == "Sample")
+                sample_column = static_cast<int>(i);
+            for (int score = 0; score < score_count; ++score)
+                if (header[i] == score_columns[score])
+                    score_column[score] = static_cast<int>(i);
+        }
+        if (entry_column < 0 || network_column < 0)
+            throw std::invalid_argument("No Entry or Network column in " + csv_path);
+
+        static const std::string empty;
+        auto field = [](const std::vector<std::string> &fields, int column) -> const std::string & {
+            return column >= 0 && static_cast<size_t>(column) < fields.size() ? fields[column] : empty;
+        };
+
+        uint64_t imported = 0;
+        std::vector<Row> rows;
+        std::vector<std::string> fields;
+        while (fill()) {
+            while (parse_csv_record(buffer, pos, fields)) {
+                if (fields.size() == 1 && fields[0].empty())
+                    continue;
+                Row row;
+                row.entry = field(fields, entry_column);
+                row.network = field(fields, network_column);
+                row.sample = field(fields, sample_column);
+                for (int score = 0; score < score_count; ++score)
+                    row.scores[score] = parse_score(field(fields, score_column[score]));
+                rows.push_back(std::move(row));
+            }
+            buffer.erase(0, pos);
+            csv_offset += pos;
+            pos = 0;
+            if (rows.size() >= 65536) {
+                imported += rows.size();
+                append(rows);
+                rows.clear();
+            }
+        }
+        imported += rows.size();
+        append(rows);
+        return imported;
+    }
+
+    // Recomputes the aggregates from the columns.
+    void rebuild_aggregates() {
+        std::vector<uint32_t> entry_codes = read_column<uint32_t>(code_file(column_entry));
+        std::vector<uint32_t> network_codes = read_column<uint32_t>(code_file(column_network));
+        std::vector<float> scores[score_count];
+        for (int score = 0; score < score_count; ++score)
+            scores[score] = read_column<float>(score_file(score));
+
+        cells.clear();
+        float row_scores[score_count];
+        for (uint64_t row = 0; row < row_count; ++row) {
+            for (int score = 0; score < score_count; ++score)
+                row_scores[score] = scores[score][row];
+            cells[{entry_codes[row], network_codes[row]}].add(row_scores);
+        }
+        save_index();
+    }
+};
+
+}
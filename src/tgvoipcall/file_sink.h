@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ring_buffer.h"
+
+// PCM output file fed from a real-time audio callback. write() only copies
+// into a wait-free ring buffer; a dedicated thread drains it to disk, so disk
+// latency never stalls the callback. A block that does not fit because the
+// writer fell behind is dropped and counted as an overrun.
+class FileSink {
+private:
+    // Two seconds of 48 kHz audio.
+    static const size_t ring_capacity = 96000;
+    static const size_t chunk_size = 4096;
+
+    std::ofstream file;
+    RingBuffer<int16_t> ring;
+    std::thread writer;
+    std::atomic<bool> running;
+    std::atomic<uint64_t> overrun_count;
+
+    void drain() {
+        int16_t chunk[chunk_size];
+        size_t n;
+        while ((n = ring.pop(chunk, chunk_size)) > 0)
+            file.write((const char *) chunk, n * sizeof(int16_t));
+    }
+
+    void run() {
+        while (running.load(std::memory_order_acquire)) {
+            drain();
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        drain();
+    }
+
+public:
+    FileSink()
+    : ring(ring_capacity)
+    , running(false)
+    , overrun_count(0)
+    {
+    }
+
+    ~FileSink() {
+        close();
+    }
+
+    bool open(const std::string &path) {
+        file.open(path, std::ios::out | std::ios::binary);
+        if (!file)
+            return false;
+        running = true;
+        writer = std::thread(&FileSink::run, this);
+        return true;
+    }
+
+    bool is_open() const {
+        return file.is_open();
+    }
+
+    // Called from the audio thread.
+    void write(const int16_t *data, size_t len) {
+        if (!ring.push(data, len))
+            overrun_count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Stops the writer thread after it has flushed everything queued so far.
+    void close() {
+        if (writer.joinable()) {
+            running = false;
+            writer.join();
+        }
+        if (file.is_open())
+            file.close();
+    }
+
+    uint64_t overruns() const {
+        return overrun_count.load(std::memory_order_relaxed);
+    }
+};
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <time.h>
+
+// Log-linear histogram of microsecond values in the spirit of HdrHistogram:
+// 16 linear sub-buckets per power of two, i.e. about 6% relative precision,
+// in a fixed array so recording never allocates.
+class LatencyHistogram {
+private:
+    static const unsigned sub_bits = 4;
+    static const uint64_t linear_limit = 2 << sub_bits;
+    static const size_t bucket_count = linear_limit + (64 - sub_bits - 1) * (1 << sub_bits);
+
+    std::array<uint64_t, bucket_count> buckets;
+    uint64_t total;
+    uint64_t max_value;
+
+    static size_t index_of(uint64_t value) {
+        if (value < linear_limit)
+            return value;
+        unsigned magnitude = 63 - __builtin_clzll(value);
+        unsigned shift = magnitude - sub_bits;
+        return linear_limit + (magnitude - sub_bits - 1) * (1 << sub_bits)
+               + ((value >> shift) - (1 << sub_bits));
+    }
+
+    // Highest value that falls into the bucket.
+    static uint64_t value_of(size_t index) {
+        if (index < linear_limit)
+            return index;
+        size_t offset = index - linear_limit;
+        unsigned shift = offset / (1 << sub_bits) + 1;
+        uint64_t top = offset % (1 << sub_bits) + (1 << sub_bits);
+        return ((top + 1) << shift) - 1;
+    }
+
+public:
+    LatencyHistogram()
+    : total(0)
+    , max_value(0)
+    {
+        buckets.fill(0);
+    }
+
+    void record(uint64_t value) {
+        ++buckets[index_of(value)];
+        ++total;
+        if (value > max_value)
+            max_value = value;
+    }
+
+    uint64_t count() const {
+        return total;
+    }
+
+    uint64_t max() const {
+        return max_value;
+    }
+
+    uint64_t percentile(double p) const {
+        if (total == 0)
+            return 0;
+        uint64_t rank = static_cast<uint64_t>(p / 100 * total + 0.5);
+        if (rank < 1)
+            rank = 1;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < bucket_count; ++i) {
+            seen += buckets[i];
+            if (seen >= rank)
+                return value_of(i) < max_value ? value_of(i) : max_value;
+        }
+        return max_value;
+    }
+};
+
+// Intervals between consecutive invocations of one audio callback, measured
+// with CLOCK_MONOTONIC_RAW. An interval longer than twice the duration of
+// the audio delivered by the previous invocation counts as an underrun.
+class CallbackStats {
+private:
+    LatencyHistogram intervals;
+    uint64_t last_ns;
+    uint64_t expected_us;
+    uint64_t underrun_count;
+
+    static uint64_t now_ns() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+        return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+    }
+
+public:
+    CallbackStats()
+    : last_ns(0)
+    , expected_us(0)
+    , underrun_count(0)
+    {
+    }
+
+    void tick(size_t samples, unsigned sample_rate = 48000) {
+        uint64_t ts = now_ns();
+        if (last_ns != 0) {
+            uint64_t interval_us = (ts - last_ns) / 1000;
+            intervals.record(interval_us);
+            if (interval_us > 2 * expected_us)
+                ++underrun_count;
+        }
+        last_ns = ts;
+        expected_us = (uint64_t) samples * 1000000 / sample_rate;
+    }
+
+    std::string to_json() const {
+        std::ostringstream json;
+        json << "{\"count\":" << intervals.count()
+             << ",\"p50\":" << intervals.percentile(50)
+             << ",\"p99\":" << intervals.percentile(99)
+             << ",\"p99.9\":" << intervals.percentile(99.9)
+             << ",\"max\":" << intervals.max()
+             << ",\"underruns\":" << underrun_count << "}";
+        return json.str();
+    }
+};
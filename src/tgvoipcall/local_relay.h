@@ -0,0 +1,174 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <poll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "impairment.h"
+#include "relay.h"
+
+// In-process relay for simulated calls: a relay::Switch on a loopback
+// socket with its own thread, reading the process clock, so it runs at the
+// virtual clock's speed together with the participants. Packets a
+// participant sends can go through an impairment::Channel seeded for that
+// participant before they are forwarded.
+class LocalRelay {
+private:
+    struct Link {
+        impairment::Channel channel;
+        bool started;
+        uint64_t start_ms;
+    };
+
+    struct Pending {
+        relay::Participant *to;
+        uint32_t slot;
+    };
+
+    int sock;
+    sockaddr_in address;
+    relay::Switch calls;
+    std::map<std::string, Link> links;
+    std::vector<std::vector<unsigned char>> buffers;
+    std::vector<uint32_t> buffer_sizes;
+    std::vector<uint32_t> free_buffers;
+    impairment::TimerWheel<Pending> wheel;
+    std::atomic<bool> running;
+    std::thread thread;
+
+    static uint64_t now_ms() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+    }
+
+    void transmit(relay::Participant &to, const unsigned char *data, size_t size) {
+        ssize_t sent = sendto(sock, data, size, 0, (const sockaddr *) &to.address, sizeof(to.address));
+        if (sent == (ssize_t) size)
+            relay::Switch::sent(to, size);
+    }
+
+    void forward(const relay::Delivery &delivery, uint64_t now) {
+        auto it = links.find(std::string((const char *) delivery.from->tag, relay::tag_size));
+        if (delivery.from == delivery.to || it == links.end()) {
+            transmit(*delivery.to, delivery.data, delivery.size);
+            return;
+        }
+        Link &link = it->second;
+        if (!link.started) {
+            link.started = true;
+            link.start_ms = now;
+        }
+        double times[2];
+        size_t copies = link.channel.schedule(now, link.start_ms, delivery.size, times);
+        for (size_t i = 0; i < copies; ++i) {
+            uint64_t due = static_cast<uint64_t>(times[i] + 0.5);
+            if (due <= now) {
+                transmit(*delivery.to, delivery.data, delivery.size);
+                continue;
+            }
+            uint32_t slot;
+            if (free_buffers.empty()) {
+                slot = static_cast<uint32_t>(buffers.size());
+                buffers.emplace_back(relay::max_packet);
+                buffer_sizes.push_back(0);
+            } else {
+                slot = free_buffers.back();
+                free_buffers.pop_back();
+            }
+            memcpy(buffers[slot].data(), delivery.data, delivery.size);
+            buffer_sizes[slot] = static_cast<uint32_t>(delivery.size);
+            wheel.insert(due, {delivery.to, slot});
+        }
+    }
+
+    void run() {
+        unsigned char data[relay::max_packet];
+        while (running) {
+            pollfd fd = {sock, POLLIN, 0};
+            // Both timeouts are on the virtual clock
+            poll(&fd, 1, wheel.size() ? 1 : 20);
+            uint64_t now = now_ms();
+            while (true) {
+                sockaddr_in from;
+                socklen_t from_size = sizeof(from);
+                ssize_t size = recvfrom(sock, data, sizeof(data), MSG_DONTWAIT, (sockaddr *) &from, &from_size);
+                if (size <= 0)
+                    break;
+                relay::Delivery delivery;
+                if (calls.handle(data, size, from, time(nullptr), delivery))
+                    forward(delivery, now);
+            }
+            wheel.advance(now, [this](const Pending &pending) {
+                transmit(*pending.to, buffers[pending.slot].data(), buffer_sizes[pending.slot]);
+                free_buffers.push_back(pending.slot);
+            });
+        }
+    }
+
+public:
+    LocalRelay()
+    : sock(socket(AF_INET, SOCK_DGRAM, 0))
+    , wheel(8192, now_ms())
+    , running(false)
+    {
+        if (sock < 0)
+            throw std::runtime_error(std::string("Can't create socket: ") + strerror(errno));
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t size = sizeof(address);
+        if (bind(sock, (const sockaddr *) &address, sizeof(address)) != 0
+                || getsockname(sock, (sockaddr *) &address, &size) != 0) {
+            close(sock);
+            throw std::runtime_error(std::string("Can't bind the local relay: ") + strerror(errno));
+        }
+    }
+
+    ~LocalRelay() {
+        stop();
+        close(sock);
+    }
+
+    LocalRelay(const LocalRelay &) = delete;
+    LocalRelay &operator=(const LocalRelay &) = delete;
+
+    // Impairs what the participant with `tag` sends; call before start().
+    void impair(const unsigned char *tag, const std::vector<impairment::Stage> &stages, uint64_t seed) {
+        links.emplace(std::string((const char *) tag, relay::tag_size),
+                      Link{impairment::Channel(stages, seed), false, 0});
+    }
+
+    // "127.0.0.1:port", as tgvoipcall takes it on the command line.
+    std::string endpoint() const {
+        return relay::to_string(address);
+    }
+
+    void start() {
+        running = true;
+        thread = std::thread([this] { run(); });
+    }
+
+    void stop() {
+        running = false;
+        if (thread.joinable())
+            thread.join();
+    }
+
+    // Per-participant counters as tgvoipreflector writes them; call after
+    // stop().
+    void write_stats(const std::string &path) const {
+        std::ofstream file(path, std::ios::out | std::ios::trunc);
+        file << calls.stats().dump() << std::endl;
+    }
+};
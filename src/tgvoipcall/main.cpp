@@ -1,46 +1,28 @@
+#include <atomic>
+#include <cerrno>
 #include <fstream>
 #include <iostream>
+#include <memory>
+#include <poll.h>
 #include <sys/eventfd.h>
 #include <unistd.h>
 #include <cstring>
 #include <time.h>
 #include <sys/time.h>
 #include "TgVoip.h"
+#include "json.h"
+#include "pcm_source.h"
+#include "file_sink.h"
+#include "latency_histogram.h"
+#include "local_relay.h"
+#include "virtual_clock.h"
 
 //#include "webrtc_dsp/rtc_base/logging.h"
 
 // using namespace std;
 
 
-int fd_stop = 0;
-bool quiting = false;
-
-void quit() {
-    quiting = true;
-    uint64_t val = 2;
-    write(fd_stop, &val, 8);
-}
-
-void wait_quit() {
-    uint64_t u;
-    read(fd_stop, &u, sizeof(u));
-}
-
 namespace call {
-TgVoip *_tgVoip = nullptr;
-auto outgoing = std::fstream();
-auto preprocessed = std::fstream();
-auto inbound = std::fstream();
-bool playing = true;
-bool recorded = false;
-bool failed = false;
-
-uint64_t init_ts = 0;
-uint64_t first_read_ts = 0;
-uint64_t last_read_ts = 0; 
-uint64_t first_write_ts = 0; 
-uint64_t last_write_ts = 0;
-
 
 uint64_t get_microseconds() {
   struct timeval tv;
@@ -49,59 +31,6 @@ uint64_t get_microseconds() {
   return (uint64_t)(tv.tv_sec) * 1000000 + (uint64_t) tv.tv_usec;
 } 
 
-void callback_state_change(TgVoipState state) {
-    switch (state) {
-        case TgVoipState::WaitInit:
-        case TgVoipState::WaitInitAck:
-        case TgVoipState::Estabilished:
-        case TgVoipState::Reconnecting:
-            break;
-
-        case TgVoipState::Failed:
-            if (!recorded) {
-              std::cerr << "Timeout while establishing the connection" << std::endl;
-            }
-            quit();
-            break;
-
-        default:
-            std::cerr << "Unexpected new call state" << std::endl;
-            quit();
-            break;
-    }
-}
-
-void play(int16_t* data, size_t len) {
-    if (!playing || quiting)
-        return;
-    outgoing.read((char *) data, len * sizeof(int16_t));
-    playing = !outgoing.fail();
-    if (first_read_ts == 0) {
-        first_read_ts = get_microseconds();
-    }
-    last_read_ts = get_microseconds();
-    if (!playing) {
-        wait_quit();
-    }
-}
-
-void record(int16_t* data, size_t len) {
-    if (quiting)
-        return;
-    recorded = true;
-    inbound.write((char *)data, len * sizeof(int16_t));
-    if (first_write_ts == 0) {
-        first_write_ts = get_microseconds();
-    }
-    last_write_ts = get_microseconds();
-}
-
-void intermediate(int16_t* data, size_t len) {
-    if (quiting)
-        return;
-    preprocessed.write((char *)data, len * sizeof(int16_t));
-}
-
 inline uint8_t letter_to_byte(char c) {
     if (c >= '0' && c <= '9') {
         return static_cast<uint8_t>(c - '0');
@@ -116,18 +45,10 @@ void hex_to_char(const std::string& in, T* out) {
         out[i] = (letter_to_byte(in[i*2]) << 4) | letter_to_byte(in[i*2+1]);
 }
 
-void close_files() {
-    if (outgoing.is_open())
-        outgoing.close();
-    if (preprocessed.is_open())
-        preprocessed.close();
-    if (inbound.is_open())
-        inbound.close();
-}
-
 const char* usage() {
     return
     "Usage: tgvoipcall host:port tag [options]\n"
+    "       tgvoipcall --sessions spec.json\n"
     "  host:port            Reflector IP address and port\n"
     "  tag hex              Participant's tag (16 bytes)\n"
     "\n"
@@ -153,11 +74,39 @@ const char* usage() {
     "                         11 - NET_TYPE_OTHER_MOBILE\n"
     " -s {never|always}     Data saving\n"
     " -n {no|yes}           Noise suspension\n"
-    " -g {no|yes}           Automatic gain control\n";
+    " -g {no|yes}           Automatic gain control\n"
+    "\n"
+    "  --sessions spec.json Run every participant listed in the spec in this\n"
+    "                       process: {\"config\": file, \"sessions\": [{\"reflector\",\n"
+    "                       \"tag\", \"key\", \"input\", \"output\", \"preprocessed\",\n"
+    "                       \"role\", \"network_type\", \"data_saving\",\n"
+    "                       \"noise_suppression\", \"agc\", \"log\"}, ...]}\n"
+    "\n"
+    "  Simulation keys of the spec:\n"
+    "    \"speed\": n         Run all clocks of the process n times faster;\n"
+    "                       needs libvirtualclock.so next to tgvoipcall\n"
+    "    \"relay\": {\"seed\": n, \"stats\": file}\n"
+    "                       Relay the sessions in-process instead of through\n"
+    "                       their \"reflector\"; each session's \"impairment\"\n"
+    "                       (a tgvoipnetem spec or a list of \"seconds:spec\"\n"
+    "                       stages) applies to the packets it sends\n";
 }
 
-void init(int argc, char **argv) {
-    TgVoipEndpoint ep;
+// Everything one participant's command line describes.
+struct Options {
+    TgVoipEndpoint endpoint;
+    std::vector<uint8_t> key = std::vector<uint8_t>(256);
+    bool is_caller = true;
+    std::string in, out, preproc;
+    TgVoipDataSaving data_saving = TgVoipDataSaving::Never;
+    bool enable_ns = false;
+    bool enable_agc = false;
+    TgVoipNetworkType net_type = TgVoipNetworkType::WiFi;
+};
+
+Options parse_options(int argc, char **argv) {
+    Options options;
+    TgVoipEndpoint &ep = options.endpoint;
     ep.endpointId = 1;
     ep.type = TgVoipEndpointType::UdpRelay;
 
@@ -173,37 +122,34 @@ void init(int argc, char **argv) {
     };
     ep.host = host;
 
-    int len;
+    int len = 0;
     sscanf(argv[2], "%*32[0-9a-f]%n", &len);
     if (len != 32)
         throw std::invalid_argument(std::string("Incorrect reflector tag: ") + argv[2]);
     hex_to_char(argv[2], ep.peerTag);
 
     int opt;
-    char key[256];
-    bool is_caller = true;
-    std::string in, out, preproc;
-    TgVoipDataSaving data_saving = TgVoipDataSaving::Never;
-    bool enable_ns = false;
-    bool enable_agc = false;
-    TgVoipNetworkType netType = TgVoipNetworkType::WiFi;
-
+    optind = 1;
+#ifdef __APPLE__
+    optreset = 1;
+#endif
     while ((opt = getopt(argc, argv, "::k:i:o:p:c:r:t:s:n:g:")) != -1) {
         switch (opt) {
             case 'k':
+                len = 0;
                 sscanf(optarg, "%*512[0-9a-f]%n", &len);
                 if (len != 512)
                     throw std::invalid_argument(std::string("Incorrect encryption key: ") + optarg);
-                hex_to_char(optarg, key);
+                hex_to_char(optarg, options.key.data());
                 break;
             case 'i':
-                in.assign(optarg);
+                options.in.assign(optarg);
                 break;
             case 'o':
-                out.assign(optarg);
+                options.out.assign(optarg);
                 break;
             case 'p':
-                preproc.assign(optarg);
+                options.preproc.assign(optarg);
                 break;
             case 'c': {
                 std::ifstream stream(optarg);
@@ -212,7 +158,7 @@ void init(int argc, char **argv) {
                 break;
             }
             case 'r':
-                is_caller = (strcmp(optarg, "caller") == 0);
+                options.is_caller = (strcmp(optarg, "caller") == 0);
                 break;
             case 't': {
                 int network_type_i = std::stoi(optarg);
@@ -221,52 +167,52 @@ void init(int argc, char **argv) {
 
                 switch (network_type_i) {
                   case 0:
-                    netType = TgVoipNetworkType::Unknown;
+                    options.net_type = TgVoipNetworkType::Unknown;
                     break;
                   case 1:
-                    netType = TgVoipNetworkType::Gprs;
+                    options.net_type = TgVoipNetworkType::Gprs;
                     break;
                   case 2:
-                    netType = TgVoipNetworkType::Edge;
+                    options.net_type = TgVoipNetworkType::Edge;
                     break;
                   case 3:
-                    netType = TgVoipNetworkType::ThirdGeneration;
+                    options.net_type = TgVoipNetworkType::ThirdGeneration;
                     break;
                   case 4:
-                    netType = TgVoipNetworkType::Hspa;
+                    options.net_type = TgVoipNetworkType::Hspa;
                     break;
                   case 5:
-                    netType = TgVoipNetworkType::Lte;
+                    options.net_type = TgVoipNetworkType::Lte;
                     break;
                   case 6:
-                    netType = TgVoipNetworkType::WiFi;
+                    options.net_type = TgVoipNetworkType::WiFi;
                     break;
                   case 7:
-                    netType = TgVoipNetworkType::Ethernet;
+                    options.net_type = TgVoipNetworkType::Ethernet;
                     break;
                   case 8:
-                    netType = TgVoipNetworkType::OtherHighSpeed;
+                    options.net_type = TgVoipNetworkType::OtherHighSpeed;
                     break;
                   case 9:
-                    netType = TgVoipNetworkType::OtherLowSpeed;
+                    options.net_type = TgVoipNetworkType::OtherLowSpeed;
                     break;
                   case 10:
-                    netType = TgVoipNetworkType::OtherMobile;
+                    options.net_type = TgVoipNetworkType::OtherMobile;
                     break;
                   case 11:
-                    netType = TgVoipNetworkType::Dialup;
+                    options.net_type = TgVoipNetworkType::Dialup;
                     break;
                 }
                 break;
             }
             case 's':
-                data_saving = (strcmp(optarg, "always") == 0) ? TgVoipDataSaving::Always : TgVoipDataSaving::Never;
+                options.data_saving = (strcmp(optarg, "always") == 0) ? TgVoipDataSaving::Always : TgVoipDataSaving::Never;
                 break;
             case 'n':
-                enable_ns = (strcmp(optarg, "yes") == 0);
+                options.enable_ns = (strcmp(optarg, "yes") == 0);
                 break;
             case 'g':
-                enable_agc = (strcmp(optarg, "yes") == 0);
+                options.enable_agc = (strcmp(optarg, "yes") == 0);
                 break;
             case '?':
                 throw std::invalid_argument(usage());
@@ -275,93 +221,377 @@ void init(int argc, char **argv) {
         }
     }
 
-    if (in.empty() || out.empty() || preproc.empty())
+    if (options.in.empty() || options.out.empty() || options.preproc.empty())
         throw std::invalid_argument("Unspecified input, output or preprocessed audio files");
 
-    outgoing.open(in, std::ios::in | std::ios::binary);
-    preprocessed.open(preproc, std::ios::out | std::ios::binary);
-    inbound.open(out, std::ios::out | std::ios::binary);
-    if (!outgoing || !preprocessed || !inbound)
-        throw std::runtime_error("At least one of input, output or preprocessed audio files could not be opened");
-
-
-    TgVoipConfig config = {
-      .initializationTimeout = 8,
-      .receiveTimeout = 3,
-      .dataSaving = data_saving,
-      .enableP2P = false,
-      .enableAEC = false,
-      .enableNS = enable_ns,
-      .enableAGC = enable_agc,
-      .enableCallUpgrade = false,
-      .logPath = "",
-      .maxApiLayer = 92
-    };
+    return options;
+}
+
+// One call participant: a TgVoip instance with its own audio files, state
+// and statistics, so several of them can live in one process.
+class Session {
+private:
+    const std::string label;
+    int fd_stop;
+    std::atomic<bool> quiting;
+    TgVoip *tgvoip;
+    PcmSource outgoing;
+    FileSink preprocessed;
+    FileSink inbound;
+    bool playing;
+    bool recorded;
+
+    uint64_t init_ts;
+    uint64_t first_read_ts;
+    uint64_t last_read_ts;
+    uint64_t first_write_ts;
+    uint64_t last_write_ts;
+
+    CallbackStats play_stats;
+    CallbackStats record_stats;
+    CallbackStats intermediate_stats;
+
+    void quit() {
+        quiting = true;
+        uint64_t val = 2;
+        write(fd_stop, &val, 8);
+    }
+
+    void callback_state_change(TgVoipState state) {
+        switch (state) {
+            case TgVoipState::WaitInit:
+            case TgVoipState::WaitInitAck:
+            case TgVoipState::Estabilished:
+            case TgVoipState::Reconnecting:
+                break;
+
+            case TgVoipState::Failed:
+                if (!recorded) {
+                  std::cerr << label << "Timeout while establishing the connection" << std::endl;
+                }
+                quit();
+                break;
+
+            default:
+                std::cerr << label << "Unexpected new call state" << std::endl;
+                quit();
+                break;
+        }
+    }
+
+    void play(int16_t* data, size_t len) {
+        if (!playing || quiting)
+            return;
+        play_stats.tick(len);
+        playing = outgoing.read(data, len) == len;
+        if (first_read_ts == 0) {
+            first_read_ts = get_microseconds();
+        }
+        last_read_ts = get_microseconds();
+        if (!playing) {
+            wait_quit();
+        }
+    }
+
+    void record(int16_t* data, size_t len) {
+        if (quiting)
+            return;
+        record_stats.tick(len);
+        recorded = true;
+        inbound.write(data, len);
+        if (first_write_ts == 0) {
+            first_write_ts = get_microseconds();
+        }
+        last_write_ts = get_microseconds();
+    }
+
+    void intermediate(int16_t* data, size_t len) {
+        if (quiting)
+            return;
+        intermediate_stats.tick(len);
+        preprocessed.write(data, len);
+    }
+
+    void close_files() {
+        preprocessed.close();
+        inbound.close();
+    }
+
+public:
+    Session(const Options &options, const std::string &label = std::string())
+    : label(label)
+    , fd_stop(-1)
+    , quiting(false)
+    , tgvoip(nullptr)
+    , outgoing(options.in)
+    , playing(true)
+    , recorded(false)
+    , init_ts(0)
+    , first_read_ts(0)
+    , last_read_ts(0)
+    , first_write_ts(0)
+    , last_write_ts(0)
+    {
+        if (!preprocessed.open(options.preproc) || !inbound.open(options.out))
+            throw std::runtime_error("At least one of input, output or preprocessed audio files could not be opened");
+        fd_stop = eventfd(0, EFD_SEMAPHORE);
+        if (fd_stop < 0)
+            throw std::runtime_error(std::string("Can't create the stop event: ") + strerror(errno));
+
+        // The destructor doesn't run if the constructor throws
+        try {
+            TgVoipConfig config = {
+              .initializationTimeout = 8,
+              .receiveTimeout = 3,
+              .dataSaving = options.data_saving,
+              .enableP2P = false,
+              .enableAEC = false,
+              .enableNS = options.enable_ns,
+              .enableAGC = options.enable_agc,
+              .enableCallUpgrade = false,
+              .logPath = "",
+              .maxApiLayer = 92
+            };
+
+            std::vector<uint8_t> derivedStateValue;
+
+            TgVoipEncryptionKey encryptionKey = {
+              .value = options.key,
+              .isOutgoing = options.is_caller,
+            };
+
+            TgVoipAudioDataCallbacks audioCallbacks = {
+              .input = [this](int16_t *data, size_t len) { play(data, len); },
+              .output = [this](int16_t *data, size_t len) { record(data, len); },
+              .preprocessed = [this](int16_t *data, size_t len) { intermediate(data, len); },
+            };
+
+            init_ts = get_microseconds();
+
+            tgvoip = TgVoip::makeInstance(
+                config,
+                { derivedStateValue },
+                {options.endpoint},
+                nullptr,
+                options.net_type,
+                encryptionKey,
+                audioCallbacks
+            );
+
+            tgvoip->setOnStateUpdated([this](TgVoipState state) { callback_state_change(state); });
+        }
+        catch (...) {
+            if (tgvoip) {
+                tgvoip->stop();
+                delete tgvoip;
+            }
+            close(fd_stop);
+            throw;
+        }
+    }
+
+    ~Session() {
+        stop(std::cout);
+        close(fd_stop);
+    }
+
+    Session(const Session &) = delete;
+    Session &operator=(const Session &) = delete;
+
+    // Readable once the call is over; wait_quit() then returns immediately.
+    int stop_fd() const {
+        return fd_stop;
+    }
+
+    void wait_quit() {
+        uint64_t u;
+        read(fd_stop, &u, sizeof(u));
+    }
 
-    std::vector<uint8_t> derivedStateValue;
+    bool is_recorded() const {
+        return recorded;
+    }
 
-    std::vector<uint8_t> encryptionKeyValue = std::vector<unsigned char>(key, key + 256);;
-    
-    TgVoipEncryptionKey encryptionKey = {
-      .value = encryptionKeyValue,
-      .isOutgoing = is_caller,
+    // Stops the call and prints its debug log and statistics to `log`.
+    void stop(std::ostream &log) {
+        if (tgvoip) {
+            TgVoipFinalState finalState = tgvoip->stop();
+            delete tgvoip;
+            tgvoip = nullptr;
+
+            if (recorded) {
+              log << finalState.debugLog << std::endl;
+              log << "TIMESTAMPS: " << init_ts << ","
+                  << first_read_ts << "," << last_read_ts << ","
+                  << first_write_ts << "," << last_write_ts << ","
+                  << inbound.overruns() << "," << preprocessed.overruns() << std::endl;
+              log << "LATENCY: {\"play\":" << play_stats.to_json()
+                  << ",\"record\":" << record_stats.to_json()
+                  << ",\"intermediate\":" << intermediate_stats.to_json() << "}" << std::endl;
+            }
+        }
+        close_files();
+    }
+};
+
+// Turns one entry of a --sessions spec into the equivalent command line,
+// with `reflector` replacing the entry's own one if it is not empty.
+std::vector<std::string> session_arguments(const json::Value &spec, const std::string &reflector) {
+    static const std::pair<const char *, const char *> flags[] = {
+        {"key", "-k"},
+        {"input", "-i"},
+        {"output", "-o"},
+        {"preprocessed", "-p"},
+        {"config", "-c"},
+        {"role", "-r"},
+        {"network_type", "-t"},
+        {"data_saving", "-s"},
+        {"noise_suppression", "-n"},
+        {"agc", "-g"},
     };
 
-    TgVoipAudioDataCallbacks audioCallbacks = {
-      .input = play,
-      .output = record,
-      .preprocessed = intermediate,
+    std::vector<std::string> args = {
+        "tgvoipcall", reflector.empty() ? spec["reflector"].to_text() : reflector, spec["tag"].to_text()
     };
+    for (const auto &flag : flags) {
+        if (spec.has(flag.first)) {
+            const json::Value &value = spec[flag.first];
+            args.push_back(flag.second);
+            // -s takes never/always rather than the no/yes of to_text()
+            if (value.type() == json::Value::Type::Bool && strcmp(flag.first, "data_saving") == 0)
+                args.push_back(value.as_bool() ? "always" : "never");
+            else
+                args.push_back(value.to_text());
+        }
+    }
+    return args;
+}
 
-    init_ts = get_microseconds();
+// Runs all participants of the spec concurrently and stops each one as soon
+// as its call is over. Returns true if every participant recorded audio.
+// With a "speed", the process is first executed again with argv under
+// libvirtualclock.so.
+bool run_sessions(const char *spec_path, char **argv) {
+    std::ifstream stream(spec_path);
+    if (!stream)
+        throw std::invalid_argument(std::string("Can't open the sessions spec ") + spec_path);
+    std::string text((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+    json::Value spec = json::parse(text);
+
+    if (spec.has("speed"))
+        virtual_clock::require_speed(spec["speed"].as_number(), argv);
+
+    if (spec.has("config")) {
+        std::ifstream config(spec["config"].as_string());
+        std::string config_str((std::istreambuf_iterator<char>(config)), std::istreambuf_iterator<char>());
+        TgVoip::setGlobalServerConfig(config_str);
+    }
 
-    _tgVoip = TgVoip::makeInstance(
-        config,
-        { derivedStateValue },
-        {ep},
-        nullptr,
-        netType,
-        encryptionKey,
-        audioCallbacks
-    );
+    const std::vector<json::Value> &entries = spec["sessions"].items();
+    std::vector<std::unique_ptr<std::ofstream>> logs;
+    for (const json::Value &entry : entries) {
+        logs.emplace_back();
+        if (entry.has("log")) {
+            logs.back().reset(new std::ofstream(entry["log"].as_string()));
+            if (!*logs.back())
+                throw std::runtime_error("Can't open the log file " + entry["log"].as_string());
+        }
+    }
 
-    _tgVoip->setOnStateUpdated(callback_state_change);
-}
+    std::unique_ptr<LocalRelay> relay;
+    std::string reflector;
+    if (spec.has("relay")) {
+        const json::Value &relay_spec = spec["relay"];
+        uint64_t seed = relay_spec.has("seed") ? static_cast<uint64_t>(relay_spec["seed"].as_number()) : 1;
+        relay.reset(new LocalRelay());
+        for (size_t i = 0; i < entries.size(); ++i) {
+            if (!entries[i].has("impairment"))
+                continue;
+            const json::Value &stages_spec = entries[i]["impairment"];
+            std::vector<impairment::Stage> stages;
+            if (stages_spec.is_array()) {
+                for (const json::Value &stage : stages_spec.items())
+                    stages.push_back(impairment::parse_stage(stage.as_string()));
+            } else {
+                stages.push_back(impairment::parse_stage(stages_spec.as_string()));
+            }
+            unsigned char tag[relay::tag_size];
+            hex_to_char(entries[i]["tag"].as_string().substr(0, 2 * relay::tag_size), tag);
+            relay->impair(tag, stages, seed + i);
+        }
+        relay->start();
+        reflector = relay->endpoint();
+    }
+
+    std::vector<std::unique_ptr<Session>> sessions;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        std::vector<std::string> args = session_arguments(entries[i], reflector);
+        std::vector<char *> argv;
+        for (std::string &arg : args)
+            argv.push_back(&arg[0]);
+        argv.push_back(nullptr);
+        Options options = parse_options(args.size(), argv.data());
+        sessions.emplace_back(new Session(options, "session " + std::to_string(i) + ": "));
+    }
 
-void stop() {
-    if (_tgVoip) {
-        TgVoipFinalState finalState = _tgVoip->stop();
-        delete _tgVoip;
-        _tgVoip = nullptr;
-
-        if (recorded) {
-          std::cout << finalState.debugLog << std::endl;
-          std::cout << "TIMESTAMPS: " << init_ts << ","
-                    << first_read_ts << "," << last_read_ts << ","
-                    << first_write_ts << "," << last_write_ts << std::endl;
+    bool all_recorded = true;
+    size_t running = sessions.size();
+    std::vector<bool> done(sessions.size(), false);
+    while (running > 0) {
+        std::vector<pollfd> fds;
+        std::vector<size_t> index;
+        for (size_t i = 0; i < sessions.size(); ++i) {
+            if (!done[i]) {
+                fds.push_back({sessions[i]->stop_fd(), POLLIN, 0});
+                index.push_back(i);
+            }
+        }
+        if (poll(fds.data(), fds.size(), -1) < 0 && errno != EINTR)
+            throw std::runtime_error("poll failed");
+        for (size_t k = 0; k < fds.size(); ++k) {
+            if (!(fds[k].revents & POLLIN))
+                continue;
+            size_t i = index[k];
+            sessions[i]->wait_quit();
+            sessions[i]->stop(logs[i] ? *logs[i] : std::cout);
+            all_recorded = all_recorded && sessions[i]->is_recorded();
+            done[i] = true;
+            --running;
         }
     }
-    close_files();
+    if (relay) {
+        relay->stop();
+        if (spec["relay"].has("stats"))
+            relay->write_stats(spec["relay"]["stats"].as_string());
+    }
+    return all_recorded;
 }
 
 }
 
 int main(int argc, char *argv[]) {
-    fd_stop = eventfd(0, EFD_SEMAPHORE);
     //rtc::LogMessage::SetLogToStderr(false);
 
+    if (argc == 3 && strcmp(argv[1], "--sessions") == 0) {
+        try {
+            return call::run_sessions(argv[2], argv) ? 0 : 1;
+        }
+        catch (std::exception &err) {
+            std::cerr << err.what() << std::endl;
+            return 1;
+        }
+    }
+
+    std::unique_ptr<call::Session> session;
     try {
-        call::init(argc, argv);
+        session.reset(new call::Session(call::parse_options(argc, argv)));
     }
     catch (std::exception &err) {
         std::cerr << err.what() << std::endl;
-        close(fd_stop);
         return 1;
     }
 
-    wait_quit();
-    call::stop();
-
-    close(fd_stop);
-    return call::recorded ? 0 : 1;
+    session->wait_quit();
+    session->stop(std::cout);
+    return session->is_recorded() ? 0 : 1;
 }
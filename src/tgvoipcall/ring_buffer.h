@@ -0,0 +1,69 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+// Wait-free single-producer/single-consumer ring buffer of trivially
+// copyable elements. The capacity is rounded up to a power of two.
+template <typename T>
+class RingBuffer {
+private:
+    std::vector<T> storage;
+    const size_t mask;
+    // Producer and consumer indices live on separate cache lines.
+    char pad0[64];
+    std::atomic<size_t> head;
+    char pad1[64 - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> tail;
+    char pad2[64 - sizeof(std::atomic<size_t>)];
+
+    static size_t round_up(size_t capacity) {
+        size_t size = 1;
+        while (size < capacity)
+            size <<= 1;
+        return size;
+    }
+
+public:
+    explicit RingBuffer(size_t capacity)
+    : storage(round_up(capacity))
+    , mask(storage.size() - 1)
+    , head(0)
+    , tail(0)
+    {
+    }
+
+    size_t capacity() const {
+        return storage.size();
+    }
+
+    // Producer side. Stores all `len` elements or none of them.
+    bool push(const T *data, size_t len) {
+        const size_t h = head.load(std::memory_order_relaxed);
+        const size_t t = tail.load(std::memory_order_acquire);
+        if (storage.size() - (h - t) < len)
+            return false;
+        const size_t start = h & mask;
+        const size_t first = std::min(len, storage.size() - start);
+        memcpy(&storage[start], data, first * sizeof(T));
+        memcpy(&storage[0], data + first, (len - first) * sizeof(T));
+        head.store(h + len, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. Takes up to `len` elements, returns how many.
+    size_t pop(T *data, size_t len) {
+        const size_t t = tail.load(std::memory_order_relaxed);
+        const size_t h = head.load(std::memory_order_acquire);
+        len = std::min(len, h - t);
+        const size_t start = t & mask;
+        const size_t first = std::min(len, storage.size() - start);
+        memcpy(data, &storage[start], first * sizeof(T));
+        memcpy(data + first, &storage[0], (len - first) * sizeof(T));
+        tail.store(t + len, std::memory_order_release);
+        return len;
+    }
+};
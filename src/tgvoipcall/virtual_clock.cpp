@@ -0,0 +1,325 @@
+#include "virtual_clock.h"
+
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <unordered_map>
+#include <dlfcn.h>
+#include <poll.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/epoll.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+// LD_PRELOAD shim of virtual_clock.h. The speed is read once, when the shim
+// is loaded, so all clocks start running faster before any thread starts.
+
+namespace virtual_clock {
+
+namespace {
+
+const int clock_count = 8;
+
+double clock_speed = 1;
+int64_t origins[clock_count];
+
+template <typename F>
+F real(const char *name) {
+    return reinterpret_cast<F>(dlsym(RTLD_NEXT, name));
+}
+
+int real_clock_gettime(clockid_t id, timespec *ts) {
+    static auto function = real<int (*)(clockid_t, timespec *)>("clock_gettime");
+    return function(id, ts);
+}
+
+int64_t to_ns(const timespec &ts) {
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+timespec from_ns(int64_t ns) {
+    timespec ts;
+    ts.tv_sec = static_cast<time_t>(ns / 1000000000);
+    ts.tv_nsec = static_cast<long>(ns % 1000000000);
+    return ts;
+}
+
+// CPU-time clocks keep running at real speed.
+bool is_scaled(clockid_t id) {
+    return clock_speed != 1 && id >= 0 && id < clock_count
+        && id != CLOCK_PROCESS_CPUTIME_ID && id != CLOCK_THREAD_CPUTIME_ID;
+}
+
+int64_t to_virtual(clockid_t id, int64_t real_ns) {
+    return origins[id] + static_cast<int64_t>((real_ns - origins[id]) * clock_speed);
+}
+
+int64_t to_real(clockid_t id, int64_t virtual_ns) {
+    return origins[id] + static_cast<int64_t>((virtual_ns - origins[id]) / clock_speed);
+}
+
+int64_t shorten(int64_t ns) {
+    return static_cast<int64_t>(ns / clock_speed);
+}
+
+// The clocks of condition variables and timerfds that aren't on
+// CLOCK_REALTIME, as they were created with. Their deadlines don't say it.
+class Clocks {
+private:
+    std::mutex mutex;
+    std::unordered_map<uintptr_t, clockid_t> clocks;
+
+public:
+    void set(uintptr_t key, clockid_t id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (id == CLOCK_REALTIME)
+            clocks.erase(key);
+        else
+            clocks[key] = id;
+    }
+
+    void erase(uintptr_t key) {
+        std::lock_guard<std::mutex> lock(mutex);
+        clocks.erase(key);
+    }
+
+    clockid_t get(uintptr_t key) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = clocks.find(key);
+        return it == clocks.end() ? CLOCK_REALTIME : it->second;
+    }
+};
+
+Clocks &condition_clocks() {
+    static Clocks *clocks = new Clocks();
+    return *clocks;
+}
+
+Clocks &timer_clocks() {
+    static Clocks *clocks = new Clocks();
+    return *clocks;
+}
+
+timespec real_deadline(clockid_t id, const timespec *abstime) {
+    return from_ns(to_real(id, to_ns(*abstime)));
+}
+
+__attribute__((constructor))
+void init() {
+    const char *text = getenv(speed_variable);
+    double speed = text ? strtod(text, nullptr) : 1;
+    for (int id = 0; id < clock_count; ++id) {
+        timespec ts = {0, 0};
+        real_clock_gettime(id, &ts);
+        origins[id] = to_ns(ts);
+    }
+    clock_speed = speed > 0 ? speed : 1;
+}
+
+}
+
+}
+
+using namespace virtual_clock;
+
+extern "C" {
+
+double virtual_clock_speed() {
+    return clock_speed;
+}
+
+int clock_gettime(clockid_t id, timespec *ts) {
+    int result = real_clock_gettime(id, ts);
+    if (result == 0 && is_scaled(id))
+        *ts = from_ns(to_virtual(id, to_ns(*ts)));
+    return result;
+}
+
+#if defined(__GLIBC__) && !__GLIBC_PREREQ(2, 31)
+int gettimeofday(timeval *tv, __timezone_ptr_t tz) {
+#else
+int gettimeofday(timeval *tv, void *tz) {
+#endif
+    static auto function = real<int (*)(timeval *, void *)>("gettimeofday");
+    if (clock_speed == 1)
+        return function(tv, tz);
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    tv->tv_sec = ts.tv_sec;
+    tv->tv_usec = ts.tv_nsec / 1000;
+    return 0;
+}
+
+time_t time(time_t *out) {
+    static auto function = real<time_t (*)(time_t *)>("time");
+    if (clock_speed == 1)
+        return function(out);
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    if (out)
+        *out = ts.tv_sec;
+    return ts.tv_sec;
+}
+
+int nanosleep(const timespec *req, timespec *rem) {
+    static auto function = real<int (*)(const timespec *, timespec *)>("nanosleep");
+    if (clock_speed == 1)
+        return function(req, rem);
+    timespec shortened = from_ns(shorten(to_ns(*req)));
+    int result = function(&shortened, rem);
+    if (result != 0 && rem)
+        *rem = from_ns(static_cast<int64_t>(to_ns(*rem) * clock_speed));
+    return result;
+}
+
+int usleep(useconds_t usec) {
+    static auto function = real<int (*)(useconds_t)>("usleep");
+    if (clock_speed == 1)
+        return function(usec);
+    return function(static_cast<useconds_t>(std::ceil(usec / clock_speed)));
+}
+
+int clock_nanosleep(clockid_t id, int flags, const timespec *req, timespec *rem) {
+    static auto function = real<int (*)(clockid_t, int, const timespec *, timespec *)>("clock_nanosleep");
+    if (!is_scaled(id))
+        return function(id, flags, req, rem);
+    if (flags & TIMER_ABSTIME) {
+        timespec deadline = real_deadline(id, req);
+        return function(id, flags, &deadline, rem);
+    }
+    timespec shortened = from_ns(shorten(to_ns(*req)));
+    int result = function(id, flags, &shortened, rem);
+    if (result == EINTR && rem)
+        *rem = from_ns(static_cast<int64_t>(to_ns(*rem) * clock_speed));
+    return result;
+}
+
+int select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, timeval *timeout) {
+    static auto function = real<int (*)(int, fd_set *, fd_set *, fd_set *, timeval *)>("select");
+    if (clock_speed == 1 || !timeout)
+        return function(nfds, readfds, writefds, exceptfds, timeout);
+    int64_t us = static_cast<int64_t>(timeout->tv_sec) * 1000000 + timeout->tv_usec;
+    int64_t shortened = static_cast<int64_t>(std::ceil(us / clock_speed));
+    timeval real_timeout = {static_cast<time_t>(shortened / 1000000), static_cast<suseconds_t>(shortened % 1000000)};
+    int result = function(nfds, readfds, writefds, exceptfds, &real_timeout);
+    // Linux reports the time left, which callers may loop on
+    int64_t left = static_cast<int64_t>((real_timeout.tv_sec * 1000000 + real_timeout.tv_usec) * clock_speed);
+    timeout->tv_sec = static_cast<time_t>(left / 1000000);
+    timeout->tv_usec = static_cast<suseconds_t>(left % 1000000);
+    return result;
+}
+
+int poll(pollfd *fds, nfds_t nfds, int timeout) {
+    static auto function = real<int (*)(pollfd *, nfds_t, int)>("poll");
+    if (clock_speed == 1 || timeout <= 0)
+        return function(fds, nfds, timeout);
+    timespec real_timeout = from_ns(shorten(static_cast<int64_t>(timeout) * 1000000));
+    return ppoll(fds, nfds, &real_timeout, nullptr);
+}
+
+int epoll_wait(int epfd, epoll_event *events, int maxevents, int timeout) {
+    static auto function = real<int (*)(int, epoll_event *, int, int)>("epoll_wait");
+    if (clock_speed == 1 || timeout <= 0)
+        return function(epfd, events, maxevents, timeout);
+    return function(epfd, events, maxevents, static_cast<int>(std::ceil(timeout / clock_speed)));
+}
+
+int pthread_cond_init(pthread_cond_t *cond, const pthread_condattr_t *attr) {
+    static auto function = real<int (*)(pthread_cond_t *, const pthread_condattr_t *)>("pthread_cond_init");
+    int result = function(cond, attr);
+    clockid_t id = CLOCK_REALTIME;
+    if (result == 0 && clock_speed != 1) {
+        if (attr)
+            pthread_condattr_getclock(attr, &id);
+        condition_clocks().set(reinterpret_cast<uintptr_t>(cond), id);
+    }
+    return result;
+}
+
+int pthread_cond_destroy(pthread_cond_t *cond) {
+    static auto function = real<int (*)(pthread_cond_t *)>("pthread_cond_destroy");
+    if (clock_speed != 1)
+        condition_clocks().erase(reinterpret_cast<uintptr_t>(cond));
+    return function(cond);
+}
+
+// The deadline is on the clock the condition variable was initialized with;
+// PTHREAD_COND_INITIALIZER ones are on CLOCK_REALTIME.
+int pthread_cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex, const timespec *abstime) {
+    static auto function = real<int (*)(pthread_cond_t *, pthread_mutex_t *, const timespec *)>("pthread_cond_timedwait");
+    if (clock_speed == 1)
+        return function(cond, mutex, abstime);
+    clockid_t id = condition_clocks().get(reinterpret_cast<uintptr_t>(cond));
+    if (!is_scaled(id))
+        return function(cond, mutex, abstime);
+    timespec deadline = real_deadline(id, abstime);
+    return function(cond, mutex, &deadline);
+}
+
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 30)
+int pthread_cond_clockwait(pthread_cond_t *cond, pthread_mutex_t *mutex, clockid_t id, const timespec *abstime) {
+    static auto function = real<int (*)(pthread_cond_t *, pthread_mutex_t *, clockid_t, const timespec *)>("pthread_cond_clockwait");
+    if (!is_scaled(id))
+        return function(cond, mutex, id, abstime);
+    timespec deadline = real_deadline(id, abstime);
+    return function(cond, mutex, id, &deadline);
+}
+#endif
+
+int sem_timedwait(sem_t *sem, const timespec *abstime) {
+    static auto function = real<int (*)(sem_t *, const timespec *)>("sem_timedwait");
+    if (clock_speed == 1)
+        return function(sem, abstime);
+    timespec deadline = real_deadline(CLOCK_REALTIME, abstime);
+    return function(sem, &deadline);
+}
+
+int timerfd_create(clockid_t id, int flags) {
+    static auto function = real<int (*)(clockid_t, int)>("timerfd_create");
+    int fd = function(id, flags);
+    if (fd >= 0 && clock_speed != 1)
+        timer_clocks().set(fd, id);
+    return fd;
+}
+
+// Absolute expirations are on the timer's clock; relative ones and the
+// interval are shortened.
+int timerfd_settime(int fd, int flags, const itimerspec *value, itimerspec *old) {
+    static auto function = real<int (*)(int, int, const itimerspec *, itimerspec *)>("timerfd_settime");
+    clockid_t id = timer_clocks().get(fd);
+    if (!is_scaled(id))
+        return function(fd, flags, value, old);
+    itimerspec real_value = *value;
+    real_value.it_interval = from_ns(shorten(to_ns(value->it_interval)));
+    bool disarm = value->it_value.tv_sec == 0 && value->it_value.tv_nsec == 0;
+    if (!disarm) {
+        if (flags & TFD_TIMER_ABSTIME)
+            real_value.it_value = real_deadline(id, &value->it_value);
+        else
+            real_value.it_value = from_ns(std::max<int64_t>(1, shorten(to_ns(value->it_value))));
+    }
+    int result = function(fd, flags, &real_value, old);
+    if (result == 0 && old) {
+        old->it_value = from_ns(static_cast<int64_t>(to_ns(old->it_value) * clock_speed));
+        old->it_interval = from_ns(static_cast<int64_t>(to_ns(old->it_interval) * clock_speed));
+    }
+    return result;
+}
+
+int timerfd_gettime(int fd, itimerspec *value) {
+    static auto function = real<int (*)(int, itimerspec *)>("timerfd_gettime");
+    int result = function(fd, value);
+    if (result == 0 && is_scaled(timer_clocks().get(fd))) {
+        value->it_value = from_ns(static_cast<int64_t>(to_ns(value->it_value) * clock_speed));
+        value->it_interval = from_ns(static_cast<int64_t>(to_ns(value->it_interval) * clock_speed));
+    }
+    return result;
+}
+
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <dlfcn.h>
+#include <limits.h>
+#include <unistd.h>
+
+// Time compression for simulated calls.
+//
+// libtgvoip paces its audio threads, jitter buffer and timeouts with the
+// system clocks. libvirtualclock.so (virtual_clock.cpp) replaces the clock,
+// sleep and timed-wait functions of libc: preloaded with the speed in
+// TGVOIP_CLOCK_SPEED, every clock of the process runs that many times
+// faster than real time and every sleep or timeout is that much shorter.
+// Only simulation runs load it; tgvoipcall itself uses libc's functions.
+namespace virtual_clock {
+
+const char *const speed_variable = "TGVOIP_CLOCK_SPEED";
+const char *const library = "libvirtualclock.so";
+
+// The speed of the preloaded shim, 1 without it.
+inline double speed() {
+    auto function = reinterpret_cast<double (*)()>(dlsym(RTLD_DEFAULT, "virtual_clock_speed"));
+    return function ? function() : 1;
+}
+
+// Makes the process run at `speed`: unless it already does, it is executed
+// again with argv and the shim, which must lie next to the executable,
+// preloaded. Returns only when the process runs at `speed`.
+inline void require_speed(double speed, char **argv) {
+    if (speed <= 0)
+        throw std::invalid_argument("The speed must be positive");
+    if (virtual_clock::speed() == speed)
+        return;
+    if (virtual_clock::speed() != 1)
+        throw std::runtime_error(std::string(library) + " is preloaded with another speed");
+
+    char exe[PATH_MAX];
+    ssize_t size = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    if (size <= 0)
+        throw std::runtime_error("Can't find the tgvoipcall executable");
+    exe[size] = '\0';
+    std::string path(exe);
+    std::string shim = path.substr(0, path.rfind('/') + 1) + library;
+    if (access(shim.c_str(), R_OK) != 0)
+        throw std::runtime_error("Can't find " + shim + ", which time compression needs");
+
+    const char *preload = getenv("LD_PRELOAD");
+    std::string preloads = preload && *preload ? shim + ":" + preload : shim;
+    setenv("LD_PRELOAD", preloads.c_str(), 1);
+    char speed_text[32];
+    snprintf(speed_text, sizeof(speed_text), "%.17g", speed);
+    setenv(speed_variable, speed_text, 1);
+    execv(exe, argv);
+    throw std::runtime_error(std::string("Can't execute ") + exe + ": " + strerror(errno));
+}
+
+}
@@ -0,0 +1,462 @@
+#include <arpa/inet.h>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "impairment.h"
+#include "json.h"
+#include "relay.h"
+
+// Userspace replacement for the tc/netem namespaces of CallTester.
+//
+// tgvoipcall talks to the proxy as if it were the relay. Every client
+// address is a flow with its own upstream socket, so the relay still sees
+// one address per participant, and its own pair of impairment channels
+// seeded from --seed and the flow number. The egress channel impairs what
+// the client sends (what netem on the client's interface did), the ingress
+// channel what it receives. Delayed packets wait in a timer wheel.
+
+namespace netem {
+
+const size_t max_packet = 2048;
+const size_t batch_size = 64;
+const uint64_t flow_timeout_ms = 60000;
+
+using relay::to_string;
+
+uint64_t monotonic_ms() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+uint64_t address_key(const sockaddr_in &address) {
+    return (static_cast<uint64_t>(address.sin_addr.s_addr) << 16) | address.sin_port;
+}
+
+struct Counters {
+    uint64_t packets = 0;
+    uint64_t bytes = 0;
+    uint64_t sent_packets = 0;
+    uint64_t sent_bytes = 0;
+    uint64_t dropped = 0;
+    uint64_t duplicated = 0;
+
+    json::Value to_json() const {
+        json::Value value = json::Value::object();
+        value.set("packets", packets);
+        value.set("bytes", bytes);
+        value.set("sent_packets", sent_packets);
+        value.set("sent_bytes", sent_bytes);
+        value.set("dropped", dropped);
+        value.set("duplicated", duplicated);
+        return value;
+    }
+};
+
+struct Flow {
+    uint64_t key;
+    size_t number;
+    sockaddr_in client;
+    int upstream_sock;
+    uint64_t start_ms;
+    uint64_t last_seen_ms;
+    impairment::Channel egress;
+    impairment::Channel ingress;
+    Counters egress_counters;
+    Counters ingress_counters;
+
+    Flow(uint64_t key, size_t number, const sockaddr_in &client, int upstream_sock, uint64_t now_ms,
+         const std::vector<impairment::Stage> &egress_stages,
+         const std::vector<impairment::Stage> &ingress_stages, uint64_t seed)
+    : key(key)
+    , number(number)
+    , client(client)
+    , upstream_sock(upstream_sock)
+    , start_ms(now_ms)
+    , last_seen_ms(now_ms)
+    , egress(egress_stages, seed + 2 * number)
+    , ingress(ingress_stages, seed + 2 * number + 1)
+    {
+    }
+};
+
+// A packet waiting in the timer wheel.
+struct Pending {
+    uint64_t flow_key;
+    bool egress;
+    uint32_t slot;
+};
+
+class Proxy {
+private:
+    int sock;
+    int epoll_fd;
+    sockaddr_in upstream;
+    std::vector<impairment::Stage> egress_stages;
+    std::vector<impairment::Stage> ingress_stages;
+    uint64_t seed;
+    std::string stats_path;
+    bool verbose;
+
+    std::unordered_map<uint64_t, Flow> flows;
+    size_t flow_count;
+    uint64_t epoch_ms;
+
+    // Packet buffers are recycled through a free list, so the steady state
+    // does not allocate.
+    std::vector<std::vector<unsigned char>> buffers;
+    std::vector<uint32_t> buffer_sizes;
+    std::vector<uint32_t> free_buffers;
+    impairment::TimerWheel<Pending> wheel;
+
+    uint64_t now_ms() const {
+        return monotonic_ms() - epoch_ms;
+    }
+
+    uint32_t acquire(const unsigned char *data, size_t size) {
+        uint32_t slot;
+        if (free_buffers.empty()) {
+            slot = static_cast<uint32_t>(buffers.size());
+            buffers.emplace_back(max_packet);
+            buffer_sizes.push_back(0);
+        } else {
+            slot = free_buffers.back();
+            free_buffers.pop_back();
+        }
+        memcpy(buffers[slot].data(), data, size);
+        buffer_sizes[slot] = static_cast<uint32_t>(size);
+        return slot;
+    }
+
+    void transmit(Flow &flow, bool egress, const unsigned char *data, size_t size) {
+        ssize_t sent;
+        if (egress)
+            sent = send(flow.upstream_sock, data, size, 0);
+        else
+            sent = sendto(sock, data, size, 0, (const sockaddr *) &flow.client, sizeof(flow.client));
+        if (sent == (ssize_t) size) {
+            Counters &counters = egress ? flow.egress_counters : flow.ingress_counters;
+            ++counters.sent_packets;
+            counters.sent_bytes += size;
+        }
+    }
+
+    void fire(const Pending &pending) {
+        auto it = flows.find(pending.flow_key);
+        if (it != flows.end())
+            transmit(it->second, pending.egress, buffers[pending.slot].data(), buffer_sizes[pending.slot]);
+        free_buffers.push_back(pending.slot);
+    }
+
+    void process(Flow &flow, bool egress, const unsigned char *data, size_t size, uint64_t now) {
+        flow.last_seen_ms = now;
+        impairment::Channel &channel = egress ? flow.egress : flow.ingress;
+        Counters &counters = egress ? flow.egress_counters : flow.ingress_counters;
+        ++counters.packets;
+        counters.bytes += size;
+
+        double times[2];
+        size_t copies = channel.schedule(now, flow.start_ms, size, times);
+        if (copies == 0)
+            ++counters.dropped;
+        else if (copies == 2)
+            ++counters.duplicated;
+        for (size_t i = 0; i < copies; ++i) {
+            uint64_t due = static_cast<uint64_t>(times[i] + 0.5);
+            if (due <= now)
+                transmit(flow, egress, data, size);
+            else
+                wheel.insert(due, {flow.key, egress, acquire(data, size)});
+        }
+    }
+
+    Flow &flow_for(const sockaddr_in &client, uint64_t now) {
+        uint64_t key = address_key(client);
+        auto it = flows.find(key);
+        if (it != flows.end())
+            return it->second;
+
+        int upstream_sock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+        if (upstream_sock < 0)
+            throw std::runtime_error(std::string("Can't create socket: ") + strerror(errno));
+        if (connect(upstream_sock, (const sockaddr *) &upstream, sizeof(upstream)) != 0) {
+            close(upstream_sock);
+            throw std::runtime_error("Can't connect to " + to_string(upstream) + ": " + strerror(errno));
+        }
+        Flow &flow = flows.emplace(std::piecewise_construct, std::forward_as_tuple(key),
+            std::forward_as_tuple(key, flow_count++, client, upstream_sock, now,
+                                  egress_stages, ingress_stages, seed)).first->second;
+        epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.u64 = key;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, upstream_sock, &event);
+        if (verbose)
+            std::cerr << "Flow " << flow.number << " from " << to_string(client) << std::endl;
+        return flow;
+    }
+
+    // Drains `fd` with recvmmsg; `handle(data, size, from)` sees every packet.
+    template <typename F>
+    void receive(int fd, F handle) {
+        static unsigned char data[batch_size][max_packet];
+        sockaddr_in addresses[batch_size];
+        iovec iovecs[batch_size];
+        mmsghdr messages[batch_size];
+        while (true) {
+            for (size_t i = 0; i < batch_size; ++i) {
+                iovecs[i] = {data[i], max_packet};
+                memset(&messages[i], 0, sizeof(messages[i]));
+                messages[i].msg_hdr.msg_iov = &iovecs[i];
+                messages[i].msg_hdr.msg_iovlen = 1;
+                messages[i].msg_hdr.msg_name = &addresses[i];
+                messages[i].msg_hdr.msg_namelen = sizeof(addresses[i]);
+            }
+            int count = recvmmsg(fd, messages, batch_size, MSG_DONTWAIT, nullptr);
+            if (count <= 0)
+                return;
+            for (int i = 0; i < count; ++i)
+                handle(data[i], messages[i].msg_len, addresses[i]);
+        }
+    }
+
+    void expire(uint64_t now) {
+        for (auto it = flows.begin(); it != flows.end();) {
+            if (now - it->second.last_seen_ms > flow_timeout_ms) {
+                close(it->second.upstream_sock);
+                it = flows.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+public:
+    Proxy(const sockaddr_in &address, const sockaddr_in &upstream,
+          const std::vector<impairment::Stage> &egress_stages,
+          const std::vector<impairment::Stage> &ingress_stages,
+          uint64_t seed, const std::string &stats_path, bool verbose)
+    : sock(socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0))
+    , epoll_fd(-1)
+    , upstream(upstream)
+    , egress_stages(egress_stages)
+    , ingress_stages(ingress_stages)
+    , seed(seed)
+    , stats_path(stats_path)
+    , verbose(verbose)
+    , flow_count(0)
+    , epoch_ms(monotonic_ms())
+    {
+        if (sock < 0)
+            throw std::runtime_error(std::string("Can't create socket: ") + strerror(errno));
+        int size = 4 << 20;
+        setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+        setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+        if (bind(sock, (const sockaddr *) &address, sizeof(address)) != 0) {
+            close(sock);
+            throw std::runtime_error("Can't bind to " + to_string(address) + ": " + strerror(errno));
+        }
+        epoll_fd = epoll_create1(0);
+    }
+
+    ~Proxy() {
+        for (auto &entry : flows)
+            close(entry.second.upstream_sock);
+        close(epoll_fd);
+        close(sock);
+    }
+
+    // Counters keyed by client address. egress is what the client sent
+    // (packets) and what reached the relay (sent_packets), ingress the
+    // other way round.
+    json::Value stats() const {
+        json::Value result = json::Value::object();
+        for (const auto &entry : flows) {
+            const Flow &flow = entry.second;
+            json::Value value = json::Value::object();
+            value.set("flow", flow.number);
+            value.set("egress", flow.egress_counters.to_json());
+            value.set("ingress", flow.ingress_counters.to_json());
+            result.set(to_string(flow.client), value);
+        }
+        return result;
+    }
+
+    void write_stats() {
+        if (stats_path.empty())
+            return;
+        std::string tmp_path = stats_path + ".tmp";
+        {
+            std::ofstream file(tmp_path, std::ios::out | std::ios::trunc);
+            file << stats().dump() << std::endl;
+            if (!file)
+                return;
+        }
+        rename(tmp_path.c_str(), stats_path.c_str());
+    }
+
+    void run() {
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGINT);
+        sigaddset(&signals, SIGTERM);
+        sigaddset(&signals, SIGUSR1);
+        sigprocmask(SIG_BLOCK, &signals, nullptr);
+        int signal_fd = signalfd(-1, &signals, SFD_NONBLOCK);
+
+        // Client flows use their key as epoll data; 0 and 1 can't be keys
+        // of a valid address with a non-zero port.
+        const uint64_t listen_id = 0;
+        const uint64_t signal_id = 1;
+        epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.u64 = listen_id;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sock, &event);
+        event.data.u64 = signal_id;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &event);
+
+        uint64_t last_expire = now_ms();
+        bool running = true;
+        while (running) {
+            epoll_event events[batch_size];
+            int timeout = wheel.size() ? 1 : 1000;
+            int count = epoll_wait(epoll_fd, events, batch_size, timeout);
+            if (count < 0 && errno != EINTR)
+                break;
+            uint64_t now = now_ms();
+            for (int i = 0; i < count; ++i) {
+                uint64_t id = events[i].data.u64;
+                if (id == listen_id) {
+                    receive(sock, [this, now](const unsigned char *data, size_t size, const sockaddr_in &from) {
+                        process(flow_for(from, now), true, data, size, now);
+                    });
+                } else if (id == signal_id) {
+                    signalfd_siginfo info;
+                    while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+                        if (info.ssi_signo == SIGUSR1)
+                            write_stats();
+                        else
+                            running = false;
+                    }
+                } else {
+                    auto it = flows.find(id);
+                    if (it == flows.end())
+                        continue;
+                    Flow &flow = it->second;
+                    receive(flow.upstream_sock, [this, &flow, now](const unsigned char *data, size_t size, const sockaddr_in &) {
+                        process(flow, false, data, size, now);
+                    });
+                }
+            }
+            wheel.advance(now, [this](const Pending &pending) {
+                fire(pending);
+            });
+            if (now - last_expire >= 1000) {
+                last_expire = now;
+                expire(now);
+            }
+        }
+
+        write_stats();
+        close(signal_fd);
+    }
+};
+
+}
+
+const char *usage() {
+    return
+    "Usage: tgvoipnetem [options] listen_ip:port relay_ip:port\n"
+    "  listen_ip:port       Address tgvoipcall uses as its relay\n"
+    "  relay_ip:port        Address packets are forwarded to\n"
+    "\n"
+    "Options:\n"
+    " -e, --egress spec     Impairment of the packets clients send\n"
+    " -i, --ingress spec    Impairment of the packets clients receive\n"
+    "                       spec is \"[seconds:]netem words\", e.g.\n"
+    "                       \"loss 9% 20% rate 44kbit\" or\n"
+    "                       \"3:loss gemodel 5% 60% delay 100ms 20ms 25%\";\n"
+    "                       repeat with increasing times to change the profile\n"
+    "                       during the call (relative to a flow's first packet)\n"
+    " -S, --seed number     Seed of the impairment generators (default 1)\n"
+    " -s, --stats file      Per-flow counters (JSON), written on SIGUSR1 and exit\n"
+    " -v, --verbose         Log new flows\n";
+}
+
+int main(int argc, char *argv[]) {
+    static const struct option long_options[] = {
+        {"egress", required_argument, nullptr, 'e'},
+        {"ingress", required_argument, nullptr, 'i'},
+        {"seed", required_argument, nullptr, 'S'},
+        {"stats", required_argument, nullptr, 's'},
+        {"verbose", no_argument, nullptr, 'v'},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    std::vector<impairment::Stage> egress;
+    std::vector<impairment::Stage> ingress;
+    uint64_t seed = 1;
+    std::string stats_path;
+    bool verbose = false;
+    int opt;
+    try {
+        while ((opt = getopt_long(argc, argv, "e:i:S:s:v", long_options, nullptr)) != -1) {
+            switch (opt) {
+                case 'e':
+                    egress.push_back(impairment::parse_stage(optarg));
+                    break;
+                case 'i':
+                    ingress.push_back(impairment::parse_stage(optarg));
+                    break;
+                case 'S':
+                    seed = std::stoull(optarg);
+                    break;
+                case 's':
+                    stats_path = optarg;
+                    break;
+                case 'v':
+                    verbose = true;
+                    break;
+                default:
+                    std::cerr << usage();
+                    return 1;
+            }
+        }
+    }
+    catch (std::exception &err) {
+        std::cerr << err.what() << std::endl;
+        return 1;
+    }
+
+    sockaddr_in address, upstream;
+    if (argc - optind != 2 || !relay::parse_address(argv[optind], address)
+            || !relay::parse_address(argv[optind + 1], upstream)) {
+        std::cerr << usage();
+        return 1;
+    }
+
+    try {
+        netem::Proxy proxy(address, upstream, egress, ingress, seed, stats_path, verbose);
+        proxy.run();
+    }
+    catch (std::exception &err) {
+        std::cerr << err.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,342 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <getopt.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "estimator.h"
+#include "task_graph.h"
+#include "entry997/src/tgvoiprate/estimator.h"
+#include "entry1010/src/tgvoiprate/rating.h"
+#include "entry1012/src/rater.h"
+#include "entry1002/src/contest/src/rating/rate.hpp"
+
+// Decodes nothing twice: every rater reads the same raw PCM, the 16 kHz
+// copies are resampled once and all six scores are computed in one process.
+// The output line is the one tests/rate-async.sh prints:
+// short,preprocess,output,997,1010,1012,1002,1007
+
+static const size_t rate48 = 48000;
+static const size_t rate16 = 16000;
+
+std::vector<float> to_float(const int16_t *samples, size_t count) {
+    std::vector<float> result(count);
+    for (size_t i = 0; i < count; ++i)
+        result[i] = samples[i] / 32768.f;
+    return result;
+}
+
+// 48 kHz to 16 kHz with the speex resampler of entry1012, aligned to the
+// input: the filter delay is skipped and flushed with zeros at the end.
+std::vector<int16_t> downsample(const int16_t *samples, size_t count) {
+    int err = 0;
+    SpeexResamplerState *state = speex_resampler_init(1, rate48, rate16, 10, &err);
+    if (!state)
+        throw std::runtime_error(std::string("Can't create the resampler: ") + speex_resampler_strerror(err));
+    speex_resampler_skip_zeros(state);
+
+    std::vector<int16_t> input(samples, samples + count);
+    input.resize(count + speex_resampler_get_input_latency(state));
+    std::vector<int16_t> result(count * rate16 / rate48);
+    size_t in_pos = 0, out_pos = 0;
+    while (in_pos < input.size() && out_pos < result.size()) {
+        spx_uint32_t in_len = input.size() - in_pos;
+        spx_uint32_t out_len = result.size() - out_pos;
+        speex_resampler_process_int(state, 0, input.data() + in_pos, &in_len, result.data() + out_pos, &out_len);
+        if (in_len == 0 && out_len == 0)
+            break;
+        in_pos += in_len;
+        out_pos += out_len;
+    }
+    speex_resampler_destroy(state);
+    result.resize(out_pos);
+    return result;
+}
+
+void write_wav(const std::string &path, const std::vector<int16_t> &samples) {
+    std::string tmp_path = path + "." + std::to_string(getpid());
+    {
+        std::ofstream file(tmp_path, std::ios::out | std::ios::binary | std::ios::trunc);
+        auto put32 = [&file](uint32_t value) { file.write(reinterpret_cast<const char *>(&value), 4); };
+        auto put16 = [&file](uint16_t value) { file.write(reinterpret_cast<const char *>(&value), 2); };
+        uint32_t data_size = samples.size() * sizeof(int16_t);
+        file.write("RIFF", 4);
+        put32(36 + data_size);
+        file.write("WAVEfmt ", 8);
+        put32(16);
+        put16(1);
+        put16(1);
+        put32(rate16);
+        put32(rate16 * sizeof(int16_t));
+        put16(sizeof(int16_t));
+        put16(16);
+        file.write("data", 4);
+        put32(data_size);
+        file.write(reinterpret_cast<const char *>(samples.data()), data_size);
+        if (!file)
+            throw std::runtime_error("Can't write " + path);
+    }
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        std::remove(tmp_path.c_str());
+        throw std::runtime_error("Can't write " + path);
+    }
+}
+
+bool file_exists(const std::string &path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0;
+}
+
+std::string replace_pcm_extension(const std::string &path, const std::string &extension) {
+    if (path.size() >= 4 && path.compare(path.size() - 4, 4, ".pcm") == 0)
+        return path.substr(0, path.size() - 4) + extension;
+    return path + extension;
+}
+
+std::string shell_quote(const std::string &value) {
+    std::string result = "'";
+    for (char c : value) {
+        if (c == '\'')
+            result += "'\\''";
+        else
+            result += c;
+    }
+    return result + "'";
+}
+
+// Runs the PESQ binary of entry1007 and converts its MOS the way its
+// tgvoiprate.py does; a missing prediction counts as 0.
+double rate_pesq(const std::string &pesq, const std::string &reference, const std::string &degraded) {
+    std::string command = shell_quote(pesq) + " +16000 " + shell_quote(reference) + " " + shell_quote(degraded) + " 2>&1";
+    FILE *pipe = popen(command.c_str(), "r");
+    if (!pipe)
+        throw std::runtime_error("Can't run " + pesq);
+
+    static const std::regex prediction_re("^Prediction : PESQ_MOS = (\\d{1}\\.\\d{1,3})");
+    double prediction = 0;
+    char line[4096];
+    while (fgets(line, sizeof(line), pipe)) {
+        std::string text(line);
+        size_t start = text.find_first_not_of(" \t\r\n");
+        text = start == std::string::npos ? std::string() : text.substr(start);
+        std::smatch match;
+        if (std::regex_search(text, match, prediction_re))
+            prediction = std::min(4.5, std::max(0.0, atof(match[1].str().c_str())));
+    }
+    pclose(pipe);
+    return prediction / 4.5 * 3.4 + 1.3;
+}
+
+// Shortest representation that reads back as the same double, like the
+// floats printed by Python.
+std::string shortest(double value) {
+    for (int precision = 1; precision < 17; ++precision) {
+        std::ostringstream text;
+        text << std::setprecision(precision) << value;
+        if (strtod(text.str().c_str(), nullptr) == value)
+            return text.str();
+    }
+    std::ostringstream text;
+    text << std::setprecision(17) << value;
+    return text.str();
+}
+
+// The distorted files are cut to the sample length plus a second before the
+// other raters see them: "sample05_..." is rated on its first 6 seconds.
+long sample_duration(const std::string &reference) {
+    std::string name = reference.substr(reference.find_last_of('/') + 1);
+    static const std::regex duration_re("^sample0*(\\d+)");
+    std::smatch match;
+    if (!std::regex_search(name, match, duration_re))
+        return -1;
+    return atol(match[1].str().c_str()) + 1;
+}
+
+std::string executable_dir() {
+    char path[PATH_MAX];
+    ssize_t size = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    if (size <= 0)
+        return ".";
+    path[size] = 0;
+    std::string exe(path);
+    return exe.substr(0, exe.find_last_of('/'));
+}
+
+const char *usage() {
+    return
+    "Usage: tgvoiprate-all [options] reference.pcm preprocessed.pcm distorted.pcm\n"
+    "\n"
+    "Prints short,preprocess,output,997,1010,1012,1002,1007 scores.\n"
+    "\n"
+    "Options:\n"
+    " -c, --cache dir       Cache directory for reference spectra\n"
+    "                       (default: .spectre-cache next to the reference)\n"
+    " -j, --threads n       Worker threads (default: all cores)\n"
+    " -r, --raters dir      Directory of the other raters and their assets\n"
+    "                       (default: other_raters next to the binary)\n"
+    " -d, --duration s      Seconds of the distorted file the other raters see\n"
+    "                       (default: from the sample name, 0 for all)\n";
+}
+
+int main(int argc, char *argv[]) {
+    static const struct option long_options[] = {
+        {"cache", required_argument, nullptr, 'c'},
+        {"threads", required_argument, nullptr, 'j'},
+        {"raters", required_argument, nullptr, 'r'},
+        {"duration", required_argument, nullptr, 'd'},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    std::string cache_dir;
+    std::string raters_dir = executable_dir() + "/other_raters";
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    long duration = -1;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "c:j:r:d:", long_options, nullptr)) != -1) {
+        switch (opt) {
+            case 'c':
+                cache_dir = optarg;
+                break;
+            case 'j':
+                threads = std::max(1, atoi(optarg));
+                break;
+            case 'r':
+                raters_dir = optarg;
+                break;
+            case 'd':
+                duration = atol(optarg);
+                break;
+            default:
+                std::cerr << usage();
+                return 1;
+        }
+    }
+    if (argc - optind != 3) {
+        std::cerr << usage();
+        return 1;
+    }
+    std::string reference_path = argv[optind];
+    std::string preprocessed_path = argv[optind + 1];
+    std::string distorted_path = argv[optind + 2];
+
+    if (cache_dir.empty()) {
+        size_t slash = reference_path.find_last_of('/');
+        cache_dir = (slash == std::string::npos ? std::string(".") : reference_path.substr(0, slash)) + "/.spectre-cache";
+    }
+    if (duration < 0)
+        duration = sample_duration(reference_path);
+
+    std::unique_ptr<PcmSource> ref, preproc, result;
+    std::unique_ptr<SpectreCache> cache;
+    try {
+        ref.reset(new PcmSource(reference_path));
+        preproc.reset(new PcmSource(preprocessed_path));
+        result.reset(new PcmSource(distorted_path));
+        cache.reset(new SpectreCache(cache_dir));
+    }
+    catch (std::exception &err) {
+        std::cerr << err.what() << std::endl;
+        return 1;
+    }
+
+    size_t trimmed = result->size();
+    if (duration > 0)
+        trimmed = std::min<size_t>(trimmed, duration * rate48);
+
+    // Shared inputs of the other raters, each filled by one task
+    std::vector<float> ref48, result48;
+    std::vector<int16_t> ref16, result16;
+    std::vector<float> ref16f, result16f;
+
+    // Scores in output order, set by the task that computes them
+    enum { Short, Preprocess, Output, Entry997, Entry1010, Entry1012, Entry1002, Entry1007, Count };
+    std::string scores[Count];
+    auto format = [](double score) {
+        std::ostringstream text;
+        text << score;
+        return text.str();
+    };
+
+    TaskGraph graph;
+    graph.add("short", [&]() {
+        Estimator estimator;
+        scores[Short] = format(estimator.evaluate(*ref, *result, cache.get()));
+    });
+    graph.add("preprocess", [&]() {
+        Estimator estimator(9, 2, 0, 5);
+        scores[Preprocess] = format(estimator.evaluate(*ref, *preproc, cache.get()));
+    });
+    graph.add("output", [&]() {
+        Estimator estimator;
+        scores[Output] = format(estimator.evaluate(*preproc, *result));
+    });
+
+    size_t float48 = graph.add("float48", [&]() {
+        ref48 = to_float(ref->data(), ref->size());
+        result48 = to_float(result->data(), trimmed);
+    });
+    graph.add("997", [&]() {
+        entry997::Estimator estimator(ref48, result48);
+        scores[Entry997] = format(estimator.evaluate());
+    }, {float48});
+    // One thread: the graph already keeps every worker busy
+    graph.add("1010", [&]() {
+        scores[Entry1010] = format(tgvoiprate::Rate(ref48, result48, 1));
+    }, {float48});
+
+    size_t resample16 = graph.add("resample16", [&]() {
+        ref16 = downsample(ref->data(), ref->size());
+        result16 = downsample(result->data(), result->size());
+    });
+    graph.add("1012", [&]() {
+        size_t result16_trimmed = std::min(result16.size(), trimmed * rate16 / rate48);
+        Rater rater(raters_dir + "/entry1012/src/assets/model", ref->data(), ref->size(), result->data(), trimmed);
+        rater.setResampled(ref16.data(), ref16.size(), result16.data(), result16_trimmed);
+        scores[Entry1012] = format(rater.finalRateWeight());
+    }, {resample16});
+    graph.add("1002", [&]() {
+        size_t result16_trimmed = std::min(result16.size(), trimmed * rate16 / rate48);
+        ref16f = to_float(ref16.data(), ref16.size());
+        result16f = to_float(result16.data(), result16_trimmed);
+        std::ostringstream text;
+        text << std::setprecision(4) << tgvoipcontest::compute_rate(ref16f, result16f);
+        scores[Entry1002] = text.str();
+    }, {resample16});
+    graph.add("1007", [&]() {
+        std::string pesq = raters_dir + "/entry1007/src/environment/pesq";
+        if (!file_exists(pesq)) {
+            scores[Entry1007] = "0";
+            return;
+        }
+        std::string reference_wav = replace_pcm_extension(reference_path, ".wav");
+        std::string distorted_wav = replace_pcm_extension(distorted_path, ".wav");
+        if (!file_exists(reference_wav))
+            write_wav(reference_wav, ref16);
+        if (!file_exists(distorted_wav))
+            write_wav(distorted_wav, result16);
+        scores[Entry1007] = shortest(rate_pesq(pesq, reference_wav, distorted_wav));
+    }, {resample16});
+
+    bool rated = graph.run(threads);
+    for (size_t i = 0; i < graph.size(); ++i)
+        if (graph.failed(i))
+            std::cerr << graph.name(i) << ": " << graph.error(i) << std::endl;
+
+    for (int i = 0; i < Count; ++i)
+        std::cout << (i ? "," : "") << scores[i];
+    std::cout << std::endl;
+
+    return rated ? 0 : 1;
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// A small dependency graph of jobs run on a fixed pool of threads. A task
+// starts once all of its dependencies have finished; when one of them failed
+// the task is not run and fails too, so its outputs are never read.
+class TaskGraph {
+public:
+    typedef std::function<void()> Job;
+
+private:
+    struct Task {
+        std::string name;
+        Job job;
+        std::vector<size_t> dependents;
+        size_t pending = 0;
+        bool failed = false;
+        std::string error;
+    };
+
+    std::vector<Task> tasks;
+    std::deque<size_t> ready;
+    size_t finished = 0;
+    std::mutex mutex;
+    std::condition_variable changed;
+
+    void complete(size_t id, bool failed, const std::string &error) {
+        std::lock_guard<std::mutex> lock(mutex);
+        Task &task = tasks[id];
+        task.failed = failed;
+        task.error = error;
+        for (size_t dependent : task.dependents) {
+            Task &next = tasks[dependent];
+            if (failed && !next.failed) {
+                next.failed = true;
+                next.error = "depends on " + task.name + ", which failed";
+            }
+            if (--next.pending == 0)
+                ready.push_back(dependent);
+        }
+        ++finished;
+        changed.notify_all();
+    }
+
+    void worker() {
+        while (true) {
+            size_t id;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [this]() { return !ready.empty() || finished == tasks.size(); });
+                if (ready.empty())
+                    return;
+                id = ready.front();
+                ready.pop_front();
+                if (tasks[id].failed) {
+                    lock.unlock();
+                    complete(id, true, tasks[id].error);
+                    continue;
+                }
+            }
+            try {
+                tasks[id].job();
+                complete(id, false, std::string());
+            }
+            catch (std::exception &err) {
+                complete(id, true, err.what());
+            }
+        }
+    }
+
+public:
+    // Dependencies must have been added before, so the graph has no cycles.
+    size_t add(const std::string &name, Job job, const std::vector<size_t> &dependencies = {}) {
+        Task task;
+        task.name = name;
+        task.job = job;
+        task.pending = dependencies.size();
+        size_t id = tasks.size();
+        for (size_t dependency : dependencies)
+            tasks.at(dependency).dependents.push_back(id);
+        tasks.push_back(task);
+        if (dependencies.empty())
+            ready.push_back(id);
+        return id;
+    }
+
+    // Runs every task on `threads` workers. Returns false if any task failed.
+    bool run(unsigned threads) {
+        std::vector<std::thread> pool;
+        for (unsigned i = 1; i < threads; ++i)
+            pool.emplace_back(&TaskGraph::worker, this);
+        worker();
+        for (std::thread &thread : pool)
+            thread.join();
+
+        for (const Task &task : tasks)
+            if (task.failed)
+                return false;
+        return true;
+    }
+
+    bool failed(size_t id) const {
+        return tasks[id].failed;
+    }
+
+    const std::string &name(size_t id) const {
+        return tasks[id].name;
+    }
+
+    const std::string &error(size_t id) const {
+        return tasks[id].error;
+    }
+
+    size_t size() const {
+        return tasks.size();
+    }
+};
@@ -0,0 +1,159 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <complex>
+#include <iostream>
+#include <random>
+#include <string>
+#include <valarray>
+#include <vector>
+
+#include "estimator.h"
+
+// Checks the rating core against the implementations it replaced and times
+// both. Exits with 1 when a result differs.
+//
+// Usage: tgvoiprate-bench [sample.pcm ...]
+//
+// The samples, e.g. samples/*.pcm, are used for the median check.
+
+namespace {
+
+const double fft_tolerance = 1e-9;
+
+double elapsed_us(std::chrono::steady_clock::time_point start, size_t runs) {
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / runs;
+}
+
+// The recursive valarray FFT tgvoiprate used before FftPlan.
+void reference_fft(std::valarray<ComplexVal> &values) {
+    const size_t N = values.size();
+    if (N <= 1)
+        return;
+
+    std::valarray<ComplexVal> evens = values[std::slice(0, N / 2, 2)];
+    std::valarray<ComplexVal> odds = values[std::slice(1, N / 2, 2)];
+
+    reference_fft(evens);
+    reference_fft(odds);
+
+    for (size_t i = 0; i < N / 2; i++) {
+        ComplexVal index = std::polar(1.0, -2 * M_PI * i / N) * odds[i];
+        values[i] = evens[i] + index;
+        values[i + N / 2] = evens[i] - index;
+    }
+}
+
+// Random real frames of every size the estimators use (2^9 and 2^10).
+bool check_fft(std::mt19937 &random) {
+    static const size_t runs = 200;
+    std::uniform_real_distribution<double> sample(-1, 1);
+    bool ok = true;
+    for (size_t size : {512, 1024}) {
+        FftPlan plan(size);
+        std::vector<double> input(size), re(size / 2), im(size / 2);
+        std::valarray<ComplexVal> expected(size);
+        double max_delta = 0;
+        double plan_us = 0, reference_us = 0;
+        for (size_t run = 0; run < runs; ++run) {
+            for (size_t i = 0; i < size; ++i) {
+                input[i] = sample(random);
+                expected[i] = ComplexVal(input[i], 0);
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            plan.transform(input.data(), re.data(), im.data());
+            plan_us += elapsed_us(start, runs);
+
+            start = std::chrono::steady_clock::now();
+            reference_fft(expected);
+            reference_us += elapsed_us(start, runs);
+
+            for (size_t i = 0; i < size / 2; ++i)
+                max_delta = std::max(max_delta, std::abs(ComplexVal(re[i], im[i]) - expected[i]));
+        }
+        bool passed = max_delta < fft_tolerance;
+        ok = ok && passed;
+        std::cout << "fft " << size << ": max |delta| " << max_delta
+                  << ", " << plan_us << " us vs " << reference_us << " us "
+                  << (passed ? "ok" : "FAILED") << std::endl;
+    }
+    return ok;
+}
+
+// The sort-based median tgvoiprate used before select_median().
+double reference_median(std::vector<double> values) {
+    size_t size = values.size();
+    if (size == 0)
+        return 0;
+    std::sort(values.begin(), values.end());
+    if (size % 2 == 0)
+        return (values[size / 2 - 1] + values[size / 2]) / 2;
+    return values[size / 2];
+}
+
+// Estimator::is_silence() with the default thresholds
+bool is_silence(const std::vector<double> &spectre, double median) {
+    double max_spectre = *std::max_element(spectre.begin(), spectre.end());
+    bool speech = median > 0.015 || max_spectre > 5;
+    bool noice = std::abs(median) > 1e-5 ? (max_spectre / median) < 10 : false;
+    return !(speech && !noice);
+}
+
+// Counts the silent frames of every sample at both frame sizes with both
+// medians; the counts and the medians themselves must be the same.
+bool check_median(const std::vector<std::string> &paths) {
+    const kernels::Kernels &simd = kernels::get();
+    bool ok = true;
+    size_t frames = 0, select_silence = 0, reference_silence = 0;
+    double select_us = 0, reference_us = 0;
+    for (size_t frame_size : {512, 1024}) {
+        FftPlan plan(frame_size);
+        std::vector<double> window(frame_size);
+        for (size_t i = 0; i < frame_size; ++i)
+            window[i] = 0.5 * (1 - cos(2. * M_PI * (i / (frame_size - 1.))));
+        std::vector<float> frame(frame_size);
+        std::vector<double> windowed(frame_size), re(frame_size / 2), im(frame_size / 2);
+        std::vector<double> spectre(frame_size / 2), scratch(frame_size / 2);
+
+        for (const std::string &path : paths) {
+            PcmSource file(path);
+            for (size_t offset = 0; file.size() - offset >= frame_size; offset += frame_size) {
+                simd.to_float(file.data() + offset, frame.data(), frame_size);
+                simd.apply_window(frame.data(), window.data(), windowed.data(), frame_size);
+                plan.transform(windowed.data(), re.data(), im.data());
+                simd.magnitude(re.data(), im.data(), spectre.data(), frame_size / 2);
+
+                auto start = std::chrono::steady_clock::now();
+                scratch.assign(spectre.begin(), spectre.end());
+                double selected = select_median(scratch.begin(), scratch.end());
+                select_us += elapsed_us(start, 1);
+
+                start = std::chrono::steady_clock::now();
+                double reference = reference_median(spectre);
+                reference_us += elapsed_us(start, 1);
+
+                ok = ok && selected == reference;
+                select_silence += is_silence(spectre, selected);
+                reference_silence += is_silence(spectre, reference);
+                ++frames;
+            }
+        }
+    }
+    ok = ok && select_silence == reference_silence;
+    std::cout << "median: " << frames << " frames, " << select_silence << " vs " << reference_silence
+              << " silent, " << select_us / std::max<size_t>(frames, 1) << " us vs "
+              << reference_us / std::max<size_t>(frames, 1) << " us " << (ok ? "ok" : "FAILED") << std::endl;
+    return ok;
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    std::mt19937 random(20200310);
+    bool ok = check_fft(random);
+    if (argc > 1)
+        ok = check_median(std::vector<std::string>(argv + 1, argv + argc)) && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,394 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <valarray>
+#include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "kernels.h"
+#include "pcm_source.h"
+
+// The rating core of tgvoiprate, also linked into tgvoiprate-all.
+
+typedef std::complex<double> ComplexVal;
+
+// 64-bit FNV-1a, chained through `seed`.
+inline uint64_t hash_bytes(const void *data, size_t size, uint64_t seed = 0xcbf29ce484222325ULL) {
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    uint64_t hash = seed;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// Selection-based median, reorders the range. Returns the same value as a
+// full sort would.
+template <typename Iterator>
+double select_median(Iterator first, Iterator last) {
+    size_t size = std::distance(first, last);
+    if (size == 0)
+        return 0;
+    Iterator middle = first + size / 2;
+    std::nth_element(first, middle, last);
+    if (size % 2 == 0)
+        return (*std::max_element(first, middle) + *middle) / 2;
+    return *middle;
+}
+
+// Real-input FFT of a fixed power-of-two size. All tables are built once in
+// the constructor, so transform() performs no allocations: the real frame is
+// packed into a half-size complex sequence, transformed with iterative
+// radix-2 butterflies and then split back into the spectrum of the real signal.
+class FftPlan {
+private:
+    const size_t size;
+    const size_t half;
+    std::vector<size_t> bitrev;
+    std::vector<double> twiddle_re;
+    std::vector<double> twiddle_im;
+    std::vector<double> split_re;
+    std::vector<double> split_im;
+
+public:
+    explicit FftPlan(size_t size)
+    : size(size)
+    , half(size / 2)
+    , bitrev(size / 2)
+    , twiddle_re(size / 4)
+    , twiddle_im(size / 4)
+    , split_re(size / 2)
+    , split_im(size / 2)
+    {
+        if (size < 4 || (size & (size - 1)) != 0)
+            throw std::invalid_argument("FFT size must be a power of two");
+
+        size_t bits = 0;
+        while ((size_t(1) << bits) < half)
+            ++bits;
+        for (size_t i = 0; i < half; ++i) {
+            size_t r = 0;
+            for (size_t b = 0; b < bits; ++b)
+                r |= ((i >> b) & 1) << (bits - 1 - b);
+            bitrev[i] = r;
+        }
+        for (size_t i = 0; i < half / 2; ++i) {
+            twiddle_re[i] = std::cos(-2 * M_PI * i / half);
+            twiddle_im[i] = std::sin(-2 * M_PI * i / half);
+        }
+        for (size_t i = 0; i < half; ++i) {
+            split_re[i] = std::cos(-2 * M_PI * i / size);
+            split_im[i] = std::sin(-2 * M_PI * i / size);
+        }
+    }
+
+    // Transforms `size` real samples into the first size / 2 bins
+    // (DC up to, but not including, Nyquist) stored as split re/im arrays.
+    void transform(const double *input, double *re, double *im) const {
+        for (size_t i = 0; i < half; ++i) {
+            re[bitrev[i]] = input[2 * i];
+            im[bitrev[i]] = input[2 * i + 1];
+        }
+
+        for (size_t len = 2; len <= half; len <<= 1) {
+            const size_t step = half / len;
+            const size_t span = len / 2;
+            for (size_t start = 0; start < half; start += len) {
+                for (size_t k = 0; k < span; ++k) {
+                    const double wr = twiddle_re[k * step];
+                    const double wi = twiddle_im[k * step];
+                    const size_t a = start + k;
+                    const size_t b = a + span;
+                    const double tr = re[b] * wr - im[b] * wi;
+                    const double ti = re[b] * wi + im[b] * wr;
+                    re[b] = re[a] - tr;
+                    im[b] = im[a] - ti;
+                    re[a] += tr;
+                    im[a] += ti;
+                }
+            }
+        }
+
+        // X[k] = E[k] + W^k O[k], X[half - k] = conj(E[k] - W^k O[k]),
+        // where E and O are the spectra of the even and odd samples.
+        re[0] = re[0] + im[0];
+        im[0] = 0;
+        im[half / 2] = -im[half / 2];
+        for (size_t k = 1; k < half / 2; ++k) {
+            const size_t j = half - k;
+            const double er = (re[k] + re[j]) / 2;
+            const double ei = (im[k] - im[j]) / 2;
+            const double orr = (im[k] + im[j]) / 2;
+            const double oi = (re[j] - re[k]) / 2;
+            const double tr = split_re[k] * orr - split_im[k] * oi;
+            const double ti = split_re[k] * oi + split_im[k] * orr;
+            re[k] = er + tr;
+            im[k] = ei + ti;
+            re[j] = er - tr;
+            im[j] = ti - ei;
+        }
+    }
+};
+
+// Directory of accumulated reference spectra. Entries are keyed by a hash of
+// the file contents and the analysis parameters, so a reference sample is
+// analysed once and later ratings only read back a few kilobytes.
+class SpectreCache {
+private:
+    static const size_t magic_size = 8;
+
+    // A function rather than a static array, so the header has no
+    // out-of-line definitions.
+    static const char *magic() {
+        return "TGVRSPC1";
+    }
+
+    const std::string dir;
+
+    std::string path(uint64_t key) const {
+        char name[32];
+        snprintf(name, sizeof(name), "/%016llx.spectre", (unsigned long long) key);
+        return dir + name;
+    }
+
+public:
+    explicit SpectreCache(const std::string &dir)
+    : dir(dir)
+    {
+        mkdir(dir.c_str(), 0777);
+    }
+
+    bool load(uint64_t key, size_t &frames, size_t &silence, std::valarray<double> &spectre) const {
+        std::ifstream file(path(key), std::ios::in | std::ios::binary);
+        char header[magic_size];
+        uint64_t values[3];
+        if (!file.read(header, sizeof(header)) || !std::equal(header, header + sizeof(header), magic()))
+            return false;
+        if (!file.read((char *) values, sizeof(values)) || values[0] != spectre.size())
+            return false;
+        if (!file.read((char *) &spectre[0], spectre.size() * sizeof(double)))
+            return false;
+        // A longer file is not an entry written by store()
+        if (file.peek() != std::ifstream::traits_type::eof())
+            return false;
+        frames = values[1];
+        silence = values[2];
+        return true;
+    }
+
+    // Best effort: the entry is written to a temporary file and renamed, so
+    // concurrent raters never see a partial entry. The temporary name is
+    // unique per call, as threads of one process may store the same key.
+    // Failures are ignored.
+    void store(uint64_t key, size_t frames, size_t silence, const std::valarray<double> &spectre) const {
+        std::string final_path = path(key);
+        std::vector<char> tmp_name(final_path.begin(), final_path.end());
+        const char suffix[] = ".XXXXXX";
+        tmp_name.insert(tmp_name.end(), suffix, suffix + sizeof(suffix));
+        int fd = mkstemp(tmp_name.data());
+        if (fd < 0)
+            return;
+        fchmod(fd, 0644);
+        close(fd);
+        std::string tmp_path(tmp_name.data());
+        uint64_t values[3] = {spectre.size(), frames, silence};
+        {
+            std::ofstream file(tmp_path, std::ios::out | std::ios::binary | std::ios::trunc);
+            file.write(magic(), magic_size);
+            file.write((const char *) values, sizeof(values));
+            file.write((const char *) &spectre[0], spectre.size() * sizeof(double));
+            if (!file) {
+                file.close();
+                std::remove(tmp_path.c_str());
+                return;
+            }
+        }
+        if (std::rename(tmp_path.c_str(), final_path.c_str()) != 0)
+            std::remove(tmp_path.c_str());
+    }
+};
+
+class Estimator {
+private:
+    const kernels::Kernels &simd;
+    const size_t frame_size;
+    const size_t spectre_size;
+    std::valarray<double> window;
+    float *frame;
+    FftPlan plan;
+    std::vector<double> fft_input;
+    std::vector<double> fft_re;
+    std::vector<double> fft_im;
+    std::valarray<double> spectre;
+    std::vector<double> scratch;
+    size_t ref_frames;
+    size_t ref_silence;
+    std::valarray<double> final_ref_spectre;
+    size_t tst_frames;
+    size_t tst_silence;
+    std::valarray<double> final_tst_spectre;
+    unsigned char spectre_part;
+    float trail_k;
+    float spectre_k;
+    float trail_pow;
+    float noice_ratio;
+    float loud_threshold;
+    float multiple_threshold;
+
+public:
+    Estimator(unsigned char frame_size_pow=10, unsigned char spectre_part=30,
+              float trail_k=2, float spectre_k=3,
+              float trail_pow=2, float noice_ratio=10,
+              float loud_threshold=5, float multiple_threshold=0.015)
+    : simd(kernels::get())
+    , frame_size(pow(2, frame_size_pow))
+    , spectre_size(frame_size / 2)
+    , window(frame_size)
+    , frame(new float[frame_size])
+    , plan(frame_size)
+    , fft_input(frame_size)
+    , fft_re(frame_size / 2)
+    , fft_im(frame_size / 2)
+    , spectre(frame_size / 2)
+    , ref_frames(0)
+    , ref_silence(0)
+    , final_ref_spectre(frame_size / 2)
+    , tst_frames(0)
+    , tst_silence(0)
+    , final_tst_spectre(frame_size / 2)
+    , spectre_part(spectre_part)
+    , trail_k(trail_k)
+    , spectre_k(spectre_k)
+    , trail_pow(trail_pow)
+    , noice_ratio(noice_ratio)
+    , loud_threshold(loud_threshold)
+    , multiple_threshold(multiple_threshold)
+    {
+        scratch.reserve(spectre_size);
+        init_hanning_window();
+    }
+
+    ~Estimator() {
+        delete[] frame;
+    }
+
+    double calc_score() {
+        double trail_ratio = (.0 + tst_frames - tst_silence) / (.0 + ref_frames - ref_silence);
+        scratch.clear();
+        for (size_t i = 0; i < spectre_size / spectre_part; ++i)
+            if (final_ref_spectre[i] >= final_tst_spectre[i])
+                scratch.push_back(final_tst_spectre[i] / final_ref_spectre[i]);
+        double spectre_est = select_median(scratch.begin(), scratch.end());
+        double trail_est = std::pow(trail_ratio < 1 ? trail_ratio : 1 / trail_ratio, trail_pow);
+
+        double final_est = trail_k * trail_est + spectre_k * spectre_est;
+        final_est = std::min(5.0, std::max(1.0, final_est));
+        return final_est;
+    }
+
+    // When a cache is given, the reference analysis is looked up there first.
+    double evaluate(const PcmSource &ref, const PcmSource &tst, const SpectreCache *ref_cache = nullptr) {
+        if (ref_cache) {
+            uint64_t key = cache_key(ref);
+            if (!ref_cache->load(key, ref_frames, ref_silence, final_ref_spectre)) {
+                evaluate_ref(ref);
+                ref_cache->store(key, ref_frames, ref_silence, final_ref_spectre);
+            }
+        } else {
+            evaluate_ref(ref);
+        }
+        evaluate_tst(tst);
+        return calc_score();
+    }
+
+    void init_hanning_window() {
+        double frame_size_minus1 = static_cast<double>(frame_size) - 1;
+        for (size_t i = 0; i < frame_size; ++i)
+            window[i] = 0.5 * (1 - cos (2. * M_PI * (i / frame_size_minus1)));
+    }
+
+private:
+    // Only the parameters that influence the accumulated spectrum.
+    uint64_t cache_key(const PcmSource &file) const {
+        uint64_t key = hash_bytes(file.data(), file.size() * sizeof(int16_t));
+        key = hash_bytes(&frame_size, sizeof(frame_size), key);
+        key = hash_bytes(&noice_ratio, sizeof(noice_ratio), key);
+        key = hash_bytes(&loud_threshold, sizeof(loud_threshold), key);
+        return hash_bytes(&multiple_threshold, sizeof(multiple_threshold), key);
+    }
+
+    bool read_frame(const PcmSource &file, size_t &offset) {
+        if (file.size() - offset < frame_size)
+            return false;
+        simd.to_float(file.data() + offset, frame, frame_size);
+        offset += frame_size;
+        return true;
+    }
+
+    void calc_fft() {
+        simd.apply_window(frame, &window[0], fft_input.data(), frame_size);
+        plan.transform(fft_input.data(), fft_re.data(), fft_im.data());
+    }
+
+    void calc_spectre() {
+        calc_fft();
+        simd.magnitude(fft_re.data(), fft_im.data(), &spectre[0], spectre_size);
+    }
+
+    // Uses the preallocated scratch buffer, so no allocation per frame.
+    double calc_median(const std::valarray<double> &array) {
+        scratch.assign(std::begin(array), std::end(array));
+        return select_median(scratch.begin(), scratch.end());
+    }
+
+    bool is_silence() {
+        double median = calc_median(spectre);
+        double max_spectre = spectre.max();
+        bool is_loud = max_spectre > loud_threshold;
+        bool is_multiple = median > multiple_threshold;
+        bool speech = is_multiple or is_loud;
+        bool noice = std::abs(median) > 1e-5 ? (max_spectre / median) < noice_ratio : false;
+        bool good = speech and not noice;
+        return not good;
+    }
+
+    void evaluate_ref(const PcmSource &ref) {
+        ref_frames = 0;
+        ref_silence = 0;
+        final_ref_spectre = 0;
+        size_t offset = 0;
+        while (read_frame(ref, offset)) {
+            calc_spectre();
+            if (is_silence())
+                ++ref_silence;
+            ++ref_frames;
+            final_ref_spectre += spectre;
+        }
+    }
+
+    void evaluate_tst(const PcmSource &tst) {
+        tst_frames = 0;
+        tst_silence = 0;
+        final_tst_spectre = 0;
+        size_t offset = 0;
+        while (read_frame(tst, offset)) {
+            calc_spectre();
+            if (is_silence()) {
+                if (tst_frames > ref_frames)
+                    break;
+                ++tst_silence;
+            }
+            ++tst_frames;
+            final_tst_spectre += spectre;
+        }
+    }
+};
@@ -0,0 +1,165 @@
+#include "kernels.h"
+
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KERNELS_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define KERNELS_NEON 1
+#endif
+
+namespace kernels {
+
+namespace {
+
+const float int16_scale = 1.f / 32768;
+
+void to_float_scalar(const int16_t *src, float *dst, size_t size) {
+    for (size_t i = 0; i < size; ++i)
+        dst[i] = src[i] * int16_scale;
+}
+
+void apply_window_scalar(const float *frame, const double *window, double *dst, size_t size) {
+    for (size_t i = 0; i < size; ++i)
+        dst[i] = frame[i] * window[i];
+}
+
+void magnitude_scalar(const double *re, const double *im, double *dst, size_t size) {
+    for (size_t i = 0; i < size; ++i)
+        dst[i] = std::sqrt(re[i] * re[i] + im[i] * im[i]);
+}
+
+#if KERNELS_X86
+
+__attribute__((target("avx2")))
+void to_float_avx2(const int16_t *src, float *dst, size_t size) {
+    const __m256 scale = _mm256_set1_ps(int16_scale);
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        __m256 f = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(s));
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(f, scale));
+    }
+    to_float_scalar(src + i, dst + i, size - i);
+}
+
+__attribute__((target("avx2")))
+void apply_window_avx2(const float *frame, const double *window, double *dst, size_t size) {
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        __m256d f = _mm256_cvtps_pd(_mm_loadu_ps(frame + i));
+        _mm256_storeu_pd(dst + i, _mm256_mul_pd(f, _mm256_loadu_pd(window + i)));
+    }
+    apply_window_scalar(frame + i, window + i, dst + i, size - i);
+}
+
+__attribute__((target("avx2")))
+void magnitude_avx2(const double *re, const double *im, double *dst, size_t size) {
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        __m256d r = _mm256_loadu_pd(re + i);
+        __m256d m = _mm256_loadu_pd(im + i);
+        __m256d sq = _mm256_add_pd(_mm256_mul_pd(r, r), _mm256_mul_pd(m, m));
+        _mm256_storeu_pd(dst + i, _mm256_sqrt_pd(sq));
+    }
+    magnitude_scalar(re + i, im + i, dst + i, size - i);
+}
+
+__attribute__((target("sse4.2")))
+void to_float_sse42(const int16_t *src, float *dst, size_t size) {
+    const __m128 scale = _mm_set1_ps(int16_scale);
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        __m128 lo = _mm_cvtepi32_ps(_mm_cvtepi16_epi32(s));
+        __m128 hi = _mm_cvtepi32_ps(_mm_cvtepi16_epi32(_mm_srli_si128(s, 8)));
+        _mm_storeu_ps(dst + i, _mm_mul_ps(lo, scale));
+        _mm_storeu_ps(dst + i + 4, _mm_mul_ps(hi, scale));
+    }
+    to_float_scalar(src + i, dst + i, size - i);
+}
+
+__attribute__((target("sse4.2")))
+void apply_window_sse42(const float *frame, const double *window, double *dst, size_t size) {
+    size_t i = 0;
+    for (; i + 2 <= size; i += 2) {
+        __m128d f = _mm_cvtps_pd(_mm_castpd_ps(_mm_load_sd(reinterpret_cast<const double *>(frame + i))));
+        _mm_storeu_pd(dst + i, _mm_mul_pd(f, _mm_loadu_pd(window + i)));
+    }
+    apply_window_scalar(frame + i, window + i, dst + i, size - i);
+}
+
+__attribute__((target("sse4.2")))
+void magnitude_sse42(const double *re, const double *im, double *dst, size_t size) {
+    size_t i = 0;
+    for (; i + 2 <= size; i += 2) {
+        __m128d r = _mm_loadu_pd(re + i);
+        __m128d m = _mm_loadu_pd(im + i);
+        __m128d sq = _mm_add_pd(_mm_mul_pd(r, r), _mm_mul_pd(m, m));
+        _mm_storeu_pd(dst + i, _mm_sqrt_pd(sq));
+    }
+    magnitude_scalar(re + i, im + i, dst + i, size - i);
+}
+
+#endif
+
+#if KERNELS_NEON
+
+void to_float_neon(const int16_t *src, float *dst, size_t size) {
+    const float32x4_t scale = vdupq_n_f32(int16_scale);
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        int16x8_t s = vld1q_s16(src + i);
+        float32x4_t lo = vcvtq_f32_s32(vmovl_s16(vget_low_s16(s)));
+        float32x4_t hi = vcvtq_f32_s32(vmovl_s16(vget_high_s16(s)));
+        vst1q_f32(dst + i, vmulq_f32(lo, scale));
+        vst1q_f32(dst + i + 4, vmulq_f32(hi, scale));
+    }
+    to_float_scalar(src + i, dst + i, size - i);
+}
+
+void apply_window_neon(const float *frame, const double *window, double *dst, size_t size) {
+    size_t i = 0;
+    for (; i + 2 <= size; i += 2) {
+        float64x2_t f = vcvt_f64_f32(vld1_f32(frame + i));
+        vst1q_f64(dst + i, vmulq_f64(f, vld1q_f64(window + i)));
+    }
+    apply_window_scalar(frame + i, window + i, dst + i, size - i);
+}
+
+void magnitude_neon(const double *re, const double *im, double *dst, size_t size) {
+    size_t i = 0;
+    for (; i + 2 <= size; i += 2) {
+        float64x2_t r = vld1q_f64(re + i);
+        float64x2_t m = vld1q_f64(im + i);
+        float64x2_t sq = vaddq_f64(vmulq_f64(r, r), vmulq_f64(m, m));
+        vst1q_f64(dst + i, vsqrtq_f64(sq));
+    }
+    magnitude_scalar(re + i, im + i, dst + i, size - i);
+}
+
+#endif
+
+Kernels select() {
+#if KERNELS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return {"avx2", to_float_avx2, apply_window_avx2, magnitude_avx2};
+    if (__builtin_cpu_supports("sse4.2"))
+        return {"sse4.2", to_float_sse42, apply_window_sse42, magnitude_sse42};
+#elif KERNELS_NEON
+    return {"neon", to_float_neon, apply_window_neon, magnitude_neon};
+#endif
+    return {"scalar", to_float_scalar, apply_window_scalar, magnitude_scalar};
+}
+
+}
+
+const Kernels &get() {
+    static const Kernels selected = select();
+    return selected;
+}
+
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Per-frame vector kernels of the estimator. The implementation is chosen
+// once at startup from the CPU features (AVX2, SSE4.2, NEON or scalar).
+namespace kernels {
+
+struct Kernels {
+    const char *name;
+    // dst[i] = src[i] / 32768
+    void (*to_float)(const int16_t *src, float *dst, size_t size);
+    // dst[i] = frame[i] * window[i]
+    void (*apply_window)(const float *frame, const double *window, double *dst, size_t size);
+    // dst[i] = |re[i] + i * im[i]|
+    void (*magnitude)(const double *re, const double *im, double *dst, size_t size);
+};
+
+const Kernels &get();
+
+}
@@ -1,245 +1,243 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
 #include <complex>
+#include <cstring>
 #include <iomanip>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
 #include <valarray>
 #include <vector>
 #include <fstream>
+#include <cstdio>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "estimator.h"
+
+// One line of a batch manifest and its scores.
+struct BatchItem {
+    std::string reference;
+    std::string preprocessed;
+    std::string distorted;
+    bool rated = false;
+    double score_combined = 0;
+    double score_preprocess = 0;
+    double score_output = 0;
+};
 
-typedef std::complex<double> ComplexVal;
-
-void FFT(std::valarray<ComplexVal>& values) {
-    const size_t N = values.size();
-    if (N <= 1)
-        return;
-
-    std::valarray<ComplexVal> evens = values[std::slice(0, N / 2, 2)];
-    std::valarray<ComplexVal> odds = values[std::slice(1, N / 2, 2)];
-
-    FFT(evens);
-    FFT(odds);
-
-    for (size_t i = 0; i < N / 2; i++) {
-        ComplexVal index = std::polar(1.0, -2 * M_PI * i / N) * odds[i];
-        values[i] = evens[i] + index;
-        values[i + N / 2] = evens[i] - index;
-    }
-}
-
-class Estimator {
-private:
-    std::fstream ref;
-    std::fstream tst;
-    const size_t frame_size;
-    const size_t spectre_size;
-    std::valarray<double> window;
-    float *frame;
-    int16_t *iframe;
-    std::valarray<ComplexVal> fft;
-    std::valarray<double> spectre;
-    size_t ref_frames;
-    size_t ref_silence;
-    std::valarray<double> final_ref_spectre;
-    size_t tst_frames;
-    size_t tst_silence;
-    std::valarray<double> final_tst_spectre;
-    unsigned char spectre_part;
-    float trail_k;
-    float spectre_k;
-    float trail_pow;
-    float noice_ratio;
-    float loud_threshold;
-    float multiple_threshold;
-
-public:
-    Estimator(const char *ref_file, const char *tst_file,
-              unsigned char frame_size_pow=10, unsigned char spectre_part=30,
-              float trail_k=2, float spectre_k=3,
-              float trail_pow=2, float noice_ratio=10,
-              float loud_threshold=5, float multiple_threshold=0.015)
-    : ref(ref_file, std::ios::in | std::ios::binary)
-    , tst(tst_file, std::ios::in | std::ios::binary)
-    , frame_size(pow(2, frame_size_pow))
-    , spectre_size(frame_size / 2)
-    , window(frame_size)
-    , frame(new float[frame_size])
-    , iframe(new int16_t[frame_size])
-    , fft(frame_size)
-    , spectre(frame_size / 2)
-    , ref_frames(0)
-    , ref_silence(0)
-    , final_ref_spectre(frame_size / 2)
-    , tst_frames(0)
-    , tst_silence(0)
-    , final_tst_spectre(frame_size / 2)
-    , spectre_part(spectre_part)
-    , trail_k(trail_k)
-    , spectre_k(spectre_k)
-    , trail_pow(trail_pow)
-    , noice_ratio(noice_ratio)
-    , loud_threshold(loud_threshold)
-    , multiple_threshold(multiple_threshold)
-    {
-        if (!ref_file) {
-            close_files();
-            throw std::invalid_argument("Can't open the reference file");
+// Lines are tab-separated "reference [preprocessed] distorted" paths;
+// empty lines and lines starting with '#' are skipped.
+std::vector<BatchItem> read_manifest(const char *path) {
+    std::ifstream manifest(path);
+    if (!manifest)
+        throw std::invalid_argument(std::string("Can't open the manifest ") + path);
+
+    std::vector<BatchItem> items;
+    std::string line;
+    size_t line_no = 0;
+    while (std::getline(manifest, line)) {
+        ++line_no;
+        if (line.empty() || line[0] == '#')
+            continue;
+        std::vector<std::string> fields;
+        size_t start = 0;
+        while (true) {
+            size_t tab = line.find('\t', start);
+            fields.push_back(line.substr(start, tab - start));
+            if (tab == std::string::npos)
+                break;
+            start = tab + 1;
         }
-        if (!tst_file) {
-            close_files();
-            throw std::invalid_argument("Can't open the test file");
+        BatchItem item;
+        if (fields.size() == 2) {
+            item.reference = fields[0];
+            item.distorted = fields[1];
+        } else if (fields.size() == 3) {
+            item.reference = fields[0];
+            item.preprocessed = fields[1];
+            item.distorted = fields[2];
+        } else {
+            throw std::invalid_argument(std::string("Incorrect manifest line ") + std::to_string(line_no));
         }
-        init_hanning_window();
-    }
-
-    ~Estimator() {
-        delete[] frame;
-        delete[] iframe;
-        close_files();
-    }
-
-    double calc_score() {
-        double trail_ratio = (.0 + tst_frames - tst_silence) / (.0 + ref_frames - ref_silence);
-        std::vector<double> spectre_eval;
-        for (size_t i = 0; i < spectre_size / spectre_part; ++i)
-            if (final_ref_spectre[i] >= final_tst_spectre[i])
-                spectre_eval.push_back(final_tst_spectre[i] / final_ref_spectre[i]);
-        double spectre_est = calc_median(spectre_eval.begin(), spectre_eval.end());
-        double trail_est = std::pow(trail_ratio < 1 ? trail_ratio : 1 / trail_ratio, trail_pow);
-
-        double final_est = trail_k * trail_est + spectre_k * spectre_est;
-        final_est = std::min(5.0, std::max(1.0, final_est));
-        return final_est;
-    }
-
-    double evaluate() {
-        evaluate_ref();
-        evaluate_tst();
-        return calc_score();
+        items.push_back(item);
     }
+    return items;
+}
 
-    void init_hanning_window() {
-        double frame_size_minus1 = static_cast<double>(frame_size) - 1;
-        for (size_t i = 0; i < frame_size; ++i)
-            window[i] = 0.5 * (1 - cos (2. * M_PI * (i / frame_size_minus1)));
+std::string json_string(const std::string &value) {
+    std::string result = "\"";
+    for (char c : value) {
+        if (c == '"' || c == '\\')
+            result += '\\';
+        result += c;
     }
+    return result + "\"";
+}
 
-private:
-    void close_files() {
-        if (ref.is_open())
-            ref.close();
-        if (tst.is_open())
-            tst.close();
-    }
+// Quoted like PHP's fputcsv(), so paths with commas or quotes keep their column
+std::string csv_field(const std::string &value) {
+    if (value.find_first_of(",\"\\\n\r\t ") == std::string::npos)
+        return value;
+    std::string quoted = "\"";
+    for (char c : value) {
+        if (c == '"')
+            quoted += '"';
+        quoted += c;
+    }
+    return quoted + "\"";
+}
 
-    void to_float_frame() {
-        int16_t *s = iframe + frame_size;
-        float *d = frame + frame_size;
-        while (s >= iframe && d >= frame) {
-            *d = static_cast<float>(*s / 32768.0);
-            if (*d > 1)
-                *d = 1;
-            if (*d < -1)
-                *d = -1;
-            --s;
-            --d;
+void print_batch(const std::vector<BatchItem> &items, bool jsonl) {
+    if (!jsonl)
+        std::cout << "Reference,Preprocessed,Distorted,ScoreCombined,ScorePreprocess,ScoreOutput" << std::endl;
+    for (const BatchItem &item : items) {
+        std::ostringstream preprocess, output;
+        if (item.rated && !item.preprocessed.empty()) {
+            preprocess << item.score_preprocess;
+            output << item.score_output;
         }
-    }
-
-    bool read_frame(std::fstream &file) {
-        file.read((char *) iframe, frame_size * sizeof(int16_t));
-        to_float_frame();
-        return !file.fail();
-    }
-
-    void calc_fft() {
-        for (size_t i = 0; i < frame_size; ++i)
-            fft[i] = ComplexVal(frame[i], 0) * window[i];
-        FFT(fft);
-    }
-
-    void calc_spectre() {
-        calc_fft();
-        for (size_t i = 0; i < frame_size / 2; ++i)
-            spectre[i] = std::abs(fft[i]);
-    }
-
-    static double calc_median(const std::valarray<double> &array) {
-        size_t size = array.size();
-        if (size == 0)
-            return 0;
-        std::vector<double> copy;
-        for (const double val : array)
-            copy.push_back(val);
-        return calc_median(copy.begin(), copy.end());
-    }
-
-    template <typename Iterator>
-    static double calc_median(Iterator first, Iterator last) {
-        size_t size = std::distance(first, last);
-        if (size == 0)
-            return 0;
-        std::sort(first, last);
-        if (size % 2 == 0)
-            return (*(first + size / 2 - 1) + *(first + size / 2)) / 2;
-        return *(first + size / 2);
-    }
-
-    bool is_silence() {
-        double median = calc_median(spectre);
-        double max_spectre = spectre.max();
-        bool is_loud = max_spectre > loud_threshold;
-        bool is_multiple = median > multiple_threshold;
-        bool speech = is_multiple or is_loud;
-        bool noice = std::abs(median) > 1e-5 ? (max_spectre / median) < noice_ratio : false;
-        bool good = speech and not noice;
-        return not good;
-    }
-
-    void evaluate_ref() {
-        ref_frames = 0;
-        ref_silence = 0;
-        final_ref_spectre = 0;
-        ref.seekg(0, std::fstream::beg);
-        while (read_frame(ref)) {
-            calc_spectre();
-            if (is_silence())
-                ++ref_silence;
-            ++ref_frames;
-            final_ref_spectre += spectre;
+        std::ostringstream combined;
+        if (item.rated)
+            combined << item.score_combined;
+
+        if (jsonl) {
+            std::cout << "{\"Reference\":" << json_string(item.reference)
+                      << ",\"Preprocessed\":" << json_string(item.preprocessed)
+                      << ",\"Distorted\":" << json_string(item.distorted)
+                      << ",\"ScoreCombined\":" << (item.rated ? combined.str() : "null")
+                      << ",\"ScorePreprocess\":" << (preprocess.str().empty() ? "null" : preprocess.str())
+                      << ",\"ScoreOutput\":" << (output.str().empty() ? "null" : output.str())
+                      << "}" << std::endl;
+        } else {
+            std::cout << csv_field(item.reference) << "," << csv_field(item.preprocessed) << ","
+                      << csv_field(item.distorted) << ","
+                      << combined.str() << "," << preprocess.str() << "," << output.str() << std::endl;
         }
     }
+}
 
-    void evaluate_tst() {
-        tst_frames = 0;
-        tst_silence = 0;
-        final_tst_spectre = 0;
-        tst.seekg(0, std::fstream::beg);
-        while (read_frame(tst)) {
-            calc_spectre();
-            if (is_silence()) {
-                if (tst_frames > ref_frames)
-                    break;
-                ++tst_silence;
+// Rates all manifest items on `threads` workers. Every worker keeps its own
+// estimators, so windows and FFT plans are set up once per thread.
+void rate_batch(std::vector<BatchItem> &items, unsigned threads, const SpectreCache *cache) {
+    std::atomic<size_t> next(0);
+    std::mutex error_mutex;
+    auto worker = [&]() {
+        Estimator estimator;
+        Estimator estimator_preproc(9, 2, 0, 5);
+        Estimator estimator_network;
+        for (size_t i = next++; i < items.size(); i = next++) {
+            BatchItem &item = items[i];
+            try {
+                PcmSource ref(item.reference.c_str());
+                PcmSource result(item.distorted.c_str());
+                item.score_combined = estimator.evaluate(ref, result, cache);
+                if (!item.preprocessed.empty()) {
+                    PcmSource preproc(item.preprocessed.c_str());
+                    item.score_preprocess = estimator_preproc.evaluate(ref, preproc, cache);
+                    item.score_output = estimator_network.evaluate(preproc, result);
+                }
+                item.rated = true;
+            }
+            catch (std::exception &err) {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                std::cerr << item.distorted << ": " << err.what() << std::endl;
             }
-            ++tst_frames;
-            final_tst_spectre += spectre;
         }
-    }
-};
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned i = 1; i < threads; ++i)
+        pool.emplace_back(worker);
+    worker();
+    for (std::thread &thread : pool)
+        thread.join();
+}
+
+const char *usage() {
+    return
+    "Usage: tgvoiprate [options] reference.pcm [preprocessed.pcm] result.pcm\n"
+    "       tgvoiprate [options] --batch manifest.tsv\n"
+    "\n"
+    "Options:\n"
+    " -c, --cache dir       Cache directory for reference spectra\n"
+    " -b, --batch file      Rate every \"reference [preprocessed] result\" line\n"
+    "                       (tab-separated) of the manifest\n"
+    " -j, --threads n       Worker threads in batch mode (default: all cores)\n"
+    " -f, --format fmt      Batch output: csv (default) or jsonl\n";
+}
 
 int main(int argc, char *argv[]) {
-    if (argc < 3 || argc > 4) {
-        std::cerr << "Usage: tgvoiprate reference.pcm [preprocessed.pcm] result.pcm" << std::endl;
+    static const struct option long_options[] = {
+        {"cache", required_argument, nullptr, 'c'},
+        {"batch", required_argument, nullptr, 'b'},
+        {"threads", required_argument, nullptr, 'j'},
+        {"format", required_argument, nullptr, 'f'},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    std::unique_ptr<SpectreCache> cache;
+    const char *manifest = nullptr;
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    bool jsonl = false;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "c:b:j:f:", long_options, nullptr)) != -1) {
+        switch (opt) {
+            case 'c':
+                cache.reset(new SpectreCache(optarg));
+                break;
+            case 'b':
+                manifest = optarg;
+                break;
+            case 'j':
+                threads = std::max(1, atoi(optarg));
+                break;
+            case 'f':
+                if (strcmp(optarg, "jsonl") != 0 && strcmp(optarg, "csv") != 0) {
+                    std::cerr << usage();
+                    return 1;
+                }
+                jsonl = strcmp(optarg, "jsonl") == 0;
+                break;
+            default:
+                std::cerr << usage();
+                return 1;
+        }
+    }
+
+    int files = argc - optind;
+    char **paths = argv + optind;
+    if (manifest ? files != 0 : (files < 2 || files > 3)) {
+        std::cerr << usage();
         return 1;
     }
 
     try {
-        if (argc == 3) {
-            Estimator estimator(argv[1], argv[2]);
-            std::cout << estimator.evaluate() << std::endl;
+        if (manifest) {
+            std::vector<BatchItem> items = read_manifest(manifest);
+            rate_batch(items, threads, cache.get());
+            print_batch(items, jsonl);
+            for (const BatchItem &item : items)
+                if (!item.rated)
+                    return 1;
+        } else if (files == 2) {
+            PcmSource ref(paths[0]);
+            PcmSource tst(paths[1]);
+            Estimator estimator;
+            std::cout << estimator.evaluate(ref, tst, cache.get()) << std::endl;
         } else {
-            Estimator estimator_preproc(argv[1], argv[2], 9, 2, 0, 5);
-            Estimator estimator_network(argv[2], argv[3]);
-            std::cout << estimator_preproc.evaluate() << " " << estimator_network.evaluate() << std::endl;
+            // The preprocessed file is mapped once and feeds both scores.
+            PcmSource ref(paths[0]);
+            PcmSource preproc(paths[1]);
+            PcmSource result(paths[2]);
+            Estimator estimator_preproc(9, 2, 0, 5);
+            Estimator estimator_network;
+            std::cout << estimator_preproc.evaluate(ref, preproc, cache.get()) << " "
+                      << estimator_network.evaluate(preproc, result) << std::endl;
         }
     }
     catch (std::exception &err) {
@@ -248,4 +246,4 @@ int main(int argc, char *argv[]) {
     }
 
     return 0;
-}
\ No newline at end of file
+}
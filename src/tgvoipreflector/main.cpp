@@ -0,0 +1,241 @@
+#include <arpa/inet.h>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "json.h"
+#include "relay.h"
+
+// Local stand-in for the Telegram UDP reflectors used by tgvoipcall; the
+// call switching itself is relay::Switch.
+
+namespace reflector {
+
+using relay::max_packet;
+using relay::to_string;
+
+const size_t batch_size = 64;
+const time_t session_timeout = 60;
+
+class Reflector {
+private:
+    int sock;
+    relay::Switch calls;
+    const std::string stats_path;
+    bool stats_dirty;
+
+    void handle(unsigned char *data, size_t size, const sockaddr_in &from, time_t now) {
+        relay::Delivery delivery;
+        bool deliver = calls.handle(data, size, from, now, delivery);
+        stats_dirty = true;
+        if (!deliver)
+            return;
+        const sockaddr_in &to = delivery.to->address;
+        ssize_t sent = sendto(sock, delivery.data, delivery.size, 0, (const sockaddr *) &to, sizeof(to));
+        if (sent == (ssize_t) delivery.size)
+            relay::Switch::sent(*delivery.to, delivery.size);
+    }
+
+    void receive(time_t now) {
+        static unsigned char buffers[batch_size][max_packet];
+        sockaddr_in addresses[batch_size];
+        iovec iovecs[batch_size];
+        mmsghdr messages[batch_size];
+        while (true) {
+            for (size_t i = 0; i < batch_size; ++i) {
+                iovecs[i] = {buffers[i], max_packet};
+                memset(&messages[i], 0, sizeof(messages[i]));
+                messages[i].msg_hdr.msg_iov = &iovecs[i];
+                messages[i].msg_hdr.msg_iovlen = 1;
+                messages[i].msg_hdr.msg_name = &addresses[i];
+                messages[i].msg_hdr.msg_namelen = sizeof(addresses[i]);
+            }
+            int count = recvmmsg(sock, messages, batch_size, MSG_DONTWAIT, nullptr);
+            if (count <= 0)
+                return;
+            for (int i = 0; i < count; ++i)
+                handle(buffers[i], messages[i].msg_len, addresses[i], now);
+        }
+    }
+
+public:
+    Reflector(const sockaddr_in &address, const std::string &stats_path, bool verbose)
+    : sock(socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0))
+    , calls(verbose)
+    , stats_path(stats_path)
+    , stats_dirty(true)
+    {
+        if (sock < 0)
+            throw std::runtime_error(std::string("Can't create socket: ") + strerror(errno));
+        int size = 4 << 20;
+        setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+        setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+        if (bind(sock, (const sockaddr *) &address, sizeof(address)) != 0) {
+            close(sock);
+            throw std::runtime_error("Can't bind to " + to_string(address) + ": " + strerror(errno));
+        }
+    }
+
+    ~Reflector() {
+        close(sock);
+    }
+
+    json::Value stats() const {
+        return calls.stats();
+    }
+
+    // Rewrites the stats file through a rename, so readers never see a
+    // partially written document.
+    void write_stats() {
+        if (stats_path.empty() || !stats_dirty)
+            return;
+        std::string tmp_path = stats_path + ".tmp";
+        {
+            std::ofstream file(tmp_path, std::ios::out | std::ios::trunc);
+            file << stats().dump() << std::endl;
+            if (!file)
+                return;
+        }
+        if (rename(tmp_path.c_str(), stats_path.c_str()) == 0)
+            stats_dirty = false;
+    }
+
+    void run() {
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGINT);
+        sigaddset(&signals, SIGTERM);
+        sigaddset(&signals, SIGUSR1);
+        sigprocmask(SIG_BLOCK, &signals, nullptr);
+        int signal_fd = signalfd(-1, &signals, SFD_NONBLOCK);
+
+        int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+        itimerspec interval = {{1, 0}, {1, 0}};
+        timerfd_settime(timer_fd, 0, &interval, nullptr);
+
+        int epoll_fd = epoll_create1(0);
+        for (int fd : {sock, signal_fd, timer_fd}) {
+            epoll_event event = {};
+            event.events = EPOLLIN;
+            event.data.fd = fd;
+            epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+        }
+
+        bool running = true;
+        while (running) {
+            epoll_event events[4];
+            int count = epoll_wait(epoll_fd, events, 4, -1);
+            if (count < 0 && errno != EINTR)
+                break;
+            time_t now = time(nullptr);
+            for (int i = 0; i < count; ++i) {
+                int fd = events[i].data.fd;
+                if (fd == sock) {
+                    receive(now);
+                } else if (fd == timer_fd) {
+                    uint64_t expirations;
+                    read(timer_fd, &expirations, sizeof(expirations));
+                    write_stats();
+                    if (calls.expire(now, session_timeout))
+                        stats_dirty = true;
+                } else if (fd == signal_fd) {
+                    signalfd_siginfo info;
+                    while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+                        if (info.ssi_signo == SIGUSR1) {
+                            stats_dirty = true;
+                            write_stats();
+                        } else {
+                            running = false;
+                        }
+                    }
+                }
+            }
+        }
+
+        stats_dirty = true;
+        write_stats();
+        close(epoll_fd);
+        close(timer_fd);
+        close(signal_fd);
+    }
+};
+
+}
+
+const char *usage() {
+    return
+    "Usage: tgvoipreflector [options] ip:port\n"
+    "       tgvoipreflector --connection ip:port\n"
+    "  ip:port              Address to listen on / to advertise\n"
+    "\n"
+    "Options:\n"
+    " -s, --stats file      Per-participant packet and byte counters (JSON),\n"
+    "                       rewritten every second and on SIGUSR1\n"
+    " -v, --verbose         Log new participants\n"
+    " -g, --connection      Print connection parameters (config, encryption\n"
+    "                       key and peer tags) for one call and exit\n";
+}
+
+int main(int argc, char *argv[]) {
+    static const struct option long_options[] = {
+        {"stats", required_argument, nullptr, 's'},
+        {"verbose", no_argument, nullptr, 'v'},
+        {"connection", no_argument, nullptr, 'g'},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    std::string stats_path;
+    bool verbose = false;
+    bool generate = false;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "s:vg", long_options, nullptr)) != -1) {
+        switch (opt) {
+            case 's':
+                stats_path = optarg;
+                break;
+            case 'v':
+                verbose = true;
+                break;
+            case 'g':
+                generate = true;
+                break;
+            default:
+                std::cerr << usage();
+                return 1;
+        }
+    }
+
+    sockaddr_in address;
+    if (argc - optind != 1 || !relay::parse_address(argv[optind], address)) {
+        std::cerr << usage();
+        return 1;
+    }
+
+    try {
+        if (generate) {
+            std::cout << relay::generate_connection(address).dump() << std::endl;
+            return 0;
+        }
+        reflector::Reflector server(address, stats_path, verbose);
+        server.run();
+    }
+    catch (std::exception &err) {
+        std::cerr << err.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
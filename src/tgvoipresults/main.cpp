@@ -0,0 +1,184 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <getopt.h>
+
+#include "results.h"
+
+// Prints the tables of tests/mean.php (CallTester::printCsvScores()) from a
+// results store, importing whatever out/ratings.csv gained since the last
+// run first.
+
+namespace {
+
+struct Version {
+    uint32_t entry;
+    results::Cell total;
+};
+
+// PHP's echo of round($value, 3).
+std::string rounded(double value) {
+    char text[32];
+    snprintf(text, sizeof(text), "%.14G", std::round(value * 1000) / 1000);
+    return text;
+}
+
+std::string pad_right(const std::string &text, size_t width) {
+    return text.size() >= width ? text : text + std::string(width - text.size(), ' ');
+}
+
+std::string pad_both(const std::string &text, size_t width) {
+    if (text.size() >= width)
+        return text;
+    size_t left = (width - text.size()) / 2;
+    return std::string(left, ' ') + text + std::string(width - text.size() - left, ' ');
+}
+
+std::string last_chars(const std::string &text, size_t count) {
+    return text.size() > count ? text.substr(text.size() - count) : text;
+}
+
+void print_scores(const results::Store &store) {
+    static const std::pair<const char *, int> score_types[] = {
+        {"ScoreFinal", results::score_count},
+        {"ScoreCombined", results::score_combined},
+        {"ScoreOutput", results::score_output},
+        {"Score1010", results::score_1010},
+        {"Score1012", results::score_1012},
+        {"Score1002", results::score_1002},
+        {"Score1007", results::score_1007},
+        {"Score997", results::score_997},
+    };
+
+    std::vector<Version> versions;
+    for (uint32_t entry = 0; entry < store.entries().size(); ++entry)
+        versions.push_back({entry, results::Cell()});
+    for (const auto &cell : store.aggregates())
+        versions[cell.first.first].total.merge(cell.second);
+
+    // mean.php's uasort() compares means truncated to thousandths
+    std::vector<Version> by_final(versions);
+    std::stable_sort(by_final.begin(), by_final.end(), [](const Version &a, const Version &b) {
+        const int final = results::score_count;
+        return static_cast<int>((b.total.scores[final].mean - a.total.scores[final].mean) * 1000) < 0;
+    });
+
+    std::cout << "Scores by library version" << std::endl << std::endl;
+    for (const Version &version : by_final) {
+        std::cout << "Version " << store.entries().value(version.entry)
+                  << " (" << version.total.scores[results::score_count].count << " ratings)" << std::endl;
+        std::cout << std::string(45, '=') << std::endl;
+        for (const auto &type : score_types) {
+            const results::Moments &moments = version.total.scores[type.second];
+            std::cout << pad_right(std::string(type.first) + ":", 20)
+                      << "mean " << rounded(moments.mean) << ", stddev: " << rounded(moments.stddev()) << std::endl;
+        }
+        std::cout << std::endl;
+    }
+
+    // mean.php sorts this table by an offset of a float, which is null for
+    // every version, so the columns stay in the order versions first appear
+    std::cout << "Scores by network" << std::endl << std::endl;
+    std::string header = pad_right("Network", 20);
+    for (const Version &version : versions)
+        header += "|" + pad_both(last_chars(store.entries().value(version.entry), 12), 12);
+    std::cout << header << std::endl << std::string(header.size(), '=') << std::endl;
+
+    for (uint32_t network = 0; network <= store.networks().size(); ++network) {
+        bool overall = network == store.networks().size();
+        if (overall)
+            std::cout << std::string(header.size(), '-') << std::endl;
+        std::cout << pad_right(last_chars(overall ? "Overall" : store.networks().value(network), 18), 20);
+        for (const Version &version : versions) {
+            const results::Moments *moments = &version.total.scores[results::score_count];
+            if (!overall) {
+                auto it = store.aggregates().find({version.entry, network});
+                moments = it == store.aggregates().end() ? nullptr : &it->second.scores[results::score_count];
+            }
+            std::cout << "|" << pad_both(moments && moments->count ? rounded(moments->mean) : "n/a", 12);
+        }
+        std::cout << std::endl;
+    }
+    std::cout << std::endl;
+}
+
+}
+
+const char *usage() {
+    return
+    "Usage: tgvoipresults [options] [ratings.csv]\n"
+    "  ratings.csv          Default out/ratings.csv\n"
+    "\n"
+    "Options:\n"
+    " -s, --store dir       Results store, default ratings.csv without .csv\n"
+    "                       plus .store\n"
+    " -n, --no-import       Print the store as it is\n"
+    " -r, --rebuild         Recompute the aggregates from the stored columns\n"
+    " -q, --quiet           Import only, print nothing\n";
+}
+
+int main(int argc, char *argv[]) {
+    static const struct option long_options[] = {
+        {"store", required_argument, nullptr, 's'},
+        {"no-import", no_argument, nullptr, 'n'},
+        {"rebuild", no_argument, nullptr, 'r'},
+        {"quiet", no_argument, nullptr, 'q'},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    std::string store_path;
+    bool import = true;
+    bool rebuild = false;
+    bool quiet = false;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "s:nrq", long_options, nullptr)) != -1) {
+        switch (opt) {
+            case 's':
+                store_path = optarg;
+                break;
+            case 'n':
+                import = false;
+                break;
+            case 'r':
+                rebuild = true;
+                break;
+            case 'q':
+                quiet = true;
+                break;
+            default:
+                std::cerr << usage();
+                return 1;
+        }
+    }
+    if (argc - optind > 1) {
+        std::cerr << usage();
+        return 1;
+    }
+
+    std::string csv_path = optind < argc ? argv[optind] : "out/ratings.csv";
+    if (store_path.empty()) {
+        store_path = csv_path;
+        if (store_path.size() > 4 && store_path.compare(store_path.size() - 4, 4, ".csv") == 0)
+            store_path.resize(store_path.size() - 4);
+        store_path += ".store";
+    }
+
+    try {
+        results::Store store(store_path);
+        if (rebuild)
+            store.rebuild_aggregates();
+        if (import)
+            store.import_csv(csv_path);
+        if (!quiet)
+            print_scores(store);
+    }
+    catch (std::exception &err) {
+        std::cerr << err.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,697 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <regex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <getopt.h>
+#include <glob.h>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "json.h"
+#include "relay.h"
+
+extern char **environ;
+
+// Runs the calls of tests/call.php without CallTester's one-at-a-time
+// loop. Every call is one tgvoipcall --sessions process with the
+// in-process relay applying the scenario's impairment, so calls need no
+// namespaces and run side by side; finished calls are rated by a second
+// pool of workers while further calls are in flight. Rows go to
+// out/ratings.csv in the layout of CallTester::getCsvWriteFD().
+
+namespace test {
+
+const char *const csv_header[] = {
+    "Entry", "Sample", "Network", "Distorted",
+    "RxBytesCaller", "RxPacketsCaller", "TxBytesCaller", "TxPacketsCaller",
+    "RxBytesCallee", "RxPacketsCallee", "TxBytesCallee", "TxPacketsCallee",
+    "TimeInitCaller", "TimeFirstReadCaller", "TimeLastReadCaller", "TimeFirstWriteCaller", "TimeLastWriteCaller",
+    "TimeInitCallee", "TimeFirstReadCallee", "TimeLastReadCallee", "TimeFirstWriteCallee", "TimeLastWriteCallee",
+    "ScoreCombined", "ScorePreprocess", "ScoreOutput",
+    "Score997", "Score1010", "Score1012", "Score1002", "Score1007",
+};
+
+struct Library {
+    std::string version;
+    std::string path;
+};
+
+struct Scenario {
+    std::string alias;
+    int network_type;
+    // tgvoipnetem stages, "seconds:spec"
+    std::vector<std::string> stages;
+};
+
+struct Plan {
+    std::vector<Library> libraries;
+    std::vector<Scenario> scenarios;
+    int files = 2;
+};
+
+struct Options {
+    std::string tgvoipcall = "bin/tgvoipcall";
+    std::string rate = "bash tests/rate-async.sh";
+    std::string samples = "samples";
+    std::string out_dir = "out/";
+    std::string preprocessed_dir = "preprocessed/";
+    int files = -1;
+    unsigned calls = 0;
+    unsigned ratings = 0;
+    double speed = 1;
+    uint64_t seed = 0;
+    bool dry_run = false;
+    bool verbose = false;
+};
+
+int network_type(const std::string &name) {
+    static const std::pair<const char *, int> types[] = {
+        {"gprs", 1}, {"edge", 2}, {"3g", 3}, {"hspa", 4}, {"lte", 5}, {"wifi", 6},
+        {"ethernet", 7}, {"other_high_speed", 8}, {"other_low_speed", 9},
+        {"dialup", 10}, {"other_mobile", 11},
+    };
+    for (const auto &type : types)
+        if (name == type.first)
+            return type.second;
+    throw std::invalid_argument("Unknown network type: " + name);
+}
+
+// Optional numeric arguments of a stage entry, CallTester's defaults for the
+// missing ones.
+std::vector<std::string> arguments(const json::Value &stage, const char *key, std::vector<double> defaults) {
+    const json::Value &value = stage[key];
+    if (value.is_array()) {
+        const std::vector<json::Value> &items = value.items();
+        for (size_t i = 0; i < items.size() && i < defaults.size(); ++i)
+            defaults[i] = items[i].as_number();
+    } else {
+        defaults[0] = value.as_number();
+    }
+    std::vector<std::string> out;
+    for (double number : defaults)
+        out.push_back(json::Value(number).to_text());
+    return out;
+}
+
+// The netem words CallTester's chain methods would queue for one stage.
+std::string stage_spec(const json::Value &stage) {
+    std::string spec;
+    if (stage.has("loss")) {
+        auto a = arguments(stage, "loss", {30, 0});
+        spec += "loss " + a[0] + "% " + a[1] + "% ";
+    }
+    if (stage.has("delay")) {
+        auto a = arguments(stage, "delay", {300, 10, 5});
+        spec += "delay " + a[0] + "ms " + a[1] + "ms " + a[2] + "% distribution normal ";
+    }
+    if (stage.has("reorder")) {
+        auto a = arguments(stage, "reorder", {30, 25});
+        spec += "reorder " + a[0] + "% " + a[1] + "% ";
+    }
+    if (stage.has("duplicate")) {
+        auto a = arguments(stage, "duplicate", {30, 0});
+        spec += "duplicate " + a[0] + "% " + a[1] + "% ";
+    }
+    if (stage.has("rate"))
+        spec += "rate " + stage["rate"].to_text() + " buffer 1600 limit 3000 ";
+    if (!spec.empty())
+        spec.pop_back();
+    return spec;
+}
+
+Plan read_plan(const std::string &path) {
+    std::ifstream stream(path);
+    if (!stream)
+        throw std::invalid_argument("Can't open the scenarios file " + path);
+    std::string text((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+    json::Value spec = json::parse(text);
+
+    Plan plan;
+    for (const auto &library : spec["libraries"].members())
+        plan.libraries.push_back({library.first, library.second.as_string()});
+    // json::Value keeps members sorted; the file order is the natural one
+    std::sort(plan.libraries.begin(), plan.libraries.end(), [&text](const Library &a, const Library &b) {
+        return text.find("\"" + a.version + "\"") < text.find("\"" + b.version + "\"");
+    });
+    if (spec.has("files"))
+        plan.files = static_cast<int>(spec["files"].as_number());
+
+    for (const json::Value &entry : spec["scenarios"].items()) {
+        Scenario scenario;
+        scenario.alias = entry["alias"].as_string();
+        scenario.network_type = network_type(entry.has("network") ? entry["network"].as_string() : "wifi");
+        double start = 0;
+        if (entry.has("stages")) {
+            for (const json::Value &stage : entry["stages"].items()) {
+                scenario.stages.push_back(json::Value(start).to_text() + ":" + stage_spec(stage));
+                if (stage.has("after"))
+                    start += stage["after"].as_number();
+            }
+        }
+        plan.scenarios.push_back(scenario);
+    }
+    return plan;
+}
+
+std::string basename(const std::string &path) {
+    size_t slash = path.rfind('/');
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+std::string dirname(const std::string &path) {
+    size_t slash = path.rfind('/');
+    return slash == std::string::npos ? "." : path.substr(0, slash);
+}
+
+// Caller and callee samples as CallTester::chooseCouple() picks them.
+class SampleChooser {
+private:
+    std::vector<std::pair<std::string, int>> files;
+    std::mt19937_64 &random;
+
+    const std::pair<std::string, int> &pick() {
+        return files[std::uniform_int_distribution<size_t>(0, files.size() - 1)(random)];
+    }
+
+public:
+    SampleChooser(const std::string &dir, std::mt19937_64 &random) : random(random) {
+        glob_t found;
+        if (glob((dir + "/*.pcm").c_str(), 0, nullptr, &found) == 0) {
+            static const std::regex duration("sample(\\d+)_");
+            for (size_t i = 0; i < found.gl_pathc; ++i) {
+                std::smatch match;
+                std::string path = found.gl_pathv[i];
+                std::string name = basename(path);
+                if (std::regex_search(name, match, duration))
+                    files.emplace_back(path, std::stoi(match[1]));
+            }
+        }
+        globfree(&found);
+        if (files.empty())
+            throw std::runtime_error("No samples in " + dir);
+    }
+
+    std::pair<std::string, std::string> choose(bool short_samples, bool oneway) {
+        while (true) {
+            const auto &caller = pick();
+            if (short_samples != (caller.second <= 7))
+                continue;
+            if (oneway)
+                return {caller.first, short_samples ? "silence/silence8.pcm" : "silence/silence18.pcm"};
+            const auto &callee = pick();
+            if (std::abs(caller.second - callee.second) <= 3)
+                return {caller.first, callee.first};
+        }
+    }
+};
+
+struct Job {
+    Library library;
+    Scenario scenario;
+    std::string caller_file;
+    std::string callee_file;
+    int iteration;
+
+    std::string caller_tag;
+    std::string callee_tag;
+    std::string caller_preprocessed;
+    std::string caller_out;
+    std::string callee_preprocessed;
+    std::string callee_out;
+    std::string spec_path;
+    std::string config_path;
+    std::string relay_stats;
+};
+
+// Paths named as in CallTester::end().
+void name_files(Job &job, const Options &options) {
+    std::string suffix = "_" + job.scenario.alias + "_" + std::to_string(job.iteration);
+    std::string prefix = job.library.version + "_";
+    job.caller_preprocessed = options.preprocessed_dir + prefix + basename(job.caller_file) + suffix + ".pcm";
+    job.caller_out = options.out_dir + prefix + basename(job.callee_file) + suffix + ".pcm";
+    job.callee_preprocessed = options.preprocessed_dir + prefix + basename(job.callee_file) + suffix + ".pcm";
+    job.callee_out = options.out_dir + prefix + basename(job.caller_file) + suffix + ".pcm";
+    job.spec_path = job.callee_out + ".sessions.json";
+    job.config_path = job.callee_out + ".config.json";
+    job.relay_stats = job.callee_out + ".relay.json";
+}
+
+std::vector<Job> make_jobs(const Plan &plan, const Options &options, std::mt19937_64 &random) {
+    SampleChooser chooser(options.samples, random);
+    std::uniform_int_distribution<int> iterations(1000000, 9999999);
+    int files = options.files >= 0 ? options.files : plan.files;
+    std::vector<Job> jobs;
+    for (int i = 0; i < files; ++i) {
+        auto couple = chooser.choose(false, i % 2 == 0);
+        for (const Library &library : plan.libraries) {
+            for (const Scenario &scenario : plan.scenarios) {
+                Job job;
+                job.library = library;
+                job.scenario = scenario;
+                job.caller_file = couple.first;
+                job.callee_file = couple.second;
+                job.iteration = iterations(random);
+                name_files(job, options);
+                jobs.push_back(job);
+            }
+        }
+    }
+    return jobs;
+}
+
+void write_file(const std::string &path, const std::string &text) {
+    std::ofstream file(path, std::ios::out | std::ios::trunc);
+    file << text;
+    if (!file)
+        throw std::runtime_error("Can't write " + path);
+}
+
+// Connection parameters and the --sessions spec of one call.
+void prepare_call(Job &job, const Options &options) {
+    sockaddr_in unused;
+    relay::parse_address("127.0.0.1:1", unused);
+    json::Value connection = relay::generate_connection(unused)["result"];
+    const json::Value &tags = connection["endpoints"].items()[0]["peer_tags"];
+    job.caller_tag = tags["caller"].as_string();
+    job.callee_tag = tags["callee"].as_string();
+    write_file(job.config_path, connection["config"].dump());
+
+    json::Value stages = json::Value::array();
+    for (const std::string &stage : job.scenario.stages)
+        stages.push(stage);
+
+    auto session = [&](bool caller) {
+        json::Value entry = json::Value::object();
+        entry.set("tag", caller ? job.caller_tag : job.callee_tag);
+        entry.set("key", connection["encryption_key"]);
+        entry.set("role", caller ? "caller" : "callee");
+        entry.set("input", caller ? job.caller_file : job.callee_file);
+        entry.set("output", caller ? job.caller_out : job.callee_out);
+        entry.set("preprocessed", caller ? job.caller_preprocessed : job.callee_preprocessed);
+        entry.set("network_type", job.scenario.network_type);
+        entry.set("log", (caller ? job.caller_out : job.callee_out) + ".log");
+        if (caller && !job.scenario.stages.empty())
+            entry.set("impairment", stages);
+        return entry;
+    };
+
+    json::Value relay = json::Value::object();
+    relay.set("seed", job.iteration);
+    relay.set("stats", job.relay_stats);
+    json::Value sessions = json::Value::array();
+    sessions.push(session(true));
+    sessions.push(session(false));
+    json::Value spec = json::Value::object();
+    spec.set("config", job.config_path);
+    spec.set("relay", relay);
+    if (options.speed != 1)
+        spec.set("speed", options.speed);
+    spec.set("sessions", sessions);
+    write_file(job.spec_path, spec.dump());
+}
+
+// Runs `args` with the library selected like CallTester::end() does and
+// both output streams in `log_path`; returns the exit status.
+int run_process(const std::vector<std::string> &args, const Library &library, const std::string &log_path) {
+    std::string library_name = basename(library.path);
+    bool by_path = library_name == "libtgvoip.so.0" || library_name == "libtgvoip.so";
+    std::string variable = by_path ? "LD_LIBRARY_PATH=" : "LD_PRELOAD=";
+    std::string library_env = variable + (by_path ? dirname(library.path) : library.path);
+
+    // The library goes first in the variable; an inherited value follows it
+    // instead of shadowing it with an earlier entry
+    std::vector<char *> env;
+    for (char **var = environ; *var; ++var) {
+        if (strncmp(*var, variable.c_str(), variable.size()) != 0)
+            env.push_back(*var);
+        else if ((*var)[variable.size()] != '\0')
+            library_env += std::string(":") + (*var + variable.size());
+    }
+    env.push_back(&library_env[0]);
+    env.push_back(nullptr);
+
+    std::vector<std::string> argv_storage(args);
+    std::vector<char *> argv;
+    for (std::string &arg : argv_storage)
+        argv.push_back(&arg[0]);
+    argv.push_back(nullptr);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, 1, log_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    posix_spawn_file_actions_adddup2(&actions, 1, 2);
+    pid_t pid;
+    int error = posix_spawn(&pid, argv[0], &actions, nullptr, argv.data(), env.data());
+    posix_spawn_file_actions_destroy(&actions);
+    if (error != 0)
+        throw std::runtime_error("Can't run " + args[0] + ": " + strerror(error));
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+        ;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+std::string read_output(const std::string &command) {
+    FILE *pipe = popen(command.c_str(), "r");
+    if (!pipe)
+        throw std::runtime_error("Can't run " + command);
+    std::string output;
+    char buf[4096];
+    size_t size;
+    while ((size = fread(buf, 1, sizeof(buf), pipe)) > 0)
+        output.append(buf, size);
+    pclose(pipe);
+    while (!output.empty() && isspace(static_cast<unsigned char>(output.back())))
+        output.pop_back();
+    return output;
+}
+
+std::vector<std::string> split(const std::string &text, char delimiter) {
+    std::vector<std::string> parts;
+    size_t start = 0;
+    while (true) {
+        size_t end = text.find(delimiter, start);
+        parts.push_back(text.substr(start, end - start));
+        if (end == std::string::npos)
+            return parts;
+        start = end + 1;
+    }
+}
+
+// The five call timestamps of a tgvoipcall log, empty if it has none.
+std::vector<std::string> timestamps(const std::string &log_path) {
+    std::ifstream log(log_path);
+    std::string line;
+    std::vector<std::string> result(5);
+    while (std::getline(log, line)) {
+        if (line.compare(0, 12, "TIMESTAMPS: ") == 0) {
+            std::vector<std::string> parts = split(line.substr(12), ',');
+            for (size_t i = 0; i < result.size() && i < parts.size(); ++i)
+                result[i] = parts[i];
+        }
+    }
+    return result;
+}
+
+// [rx bytes, rx packets, tx bytes, tx packets] of a participant as
+// CallTester::reflectorCounters() reports them.
+std::vector<std::string> counters(const json::Value &stats, const std::string &tag) {
+    if (!stats.has(tag))
+        return {"0", "0", "0", "0"};
+    const json::Value &entry = stats[tag];
+    return {
+        entry["tx_bytes"].to_text(), entry["tx_packets"].to_text(),
+        entry["rx_bytes"].to_text(), entry["rx_packets"].to_text(),
+    };
+}
+
+// Appends rows quoted like PHP's fputcsv().
+class CsvWriter {
+private:
+    FILE *file;
+    std::mutex mutex;
+
+    static std::string field(const std::string &value) {
+        if (value.find_first_of(",\"\\\n\r\t ") == std::string::npos)
+            return value;
+        std::string quoted = "\"";
+        for (char c : value) {
+            if (c == '"')
+                quoted += '"';
+            quoted += c;
+        }
+        return quoted + "\"";
+    }
+
+    void write_locked(const std::vector<std::string> &row) {
+        std::string line;
+        for (size_t i = 0; i < row.size(); ++i) {
+            if (i)
+                line += ',';
+            line += field(row[i]);
+        }
+        line += '\n';
+        fwrite(line.data(), 1, line.size(), file);
+        fflush(file);
+    }
+
+public:
+    explicit CsvWriter(const std::string &path) : file(fopen(path.c_str(), "a")) {
+        if (!file)
+            throw std::runtime_error("Can't open " + path);
+        fseek(file, 0, SEEK_END);
+        if (ftell(file) == 0)
+            write_locked(std::vector<std::string>(std::begin(csv_header), std::end(csv_header)));
+    }
+
+    ~CsvWriter() {
+        fclose(file);
+    }
+
+    void write(const std::vector<std::string> &row) {
+        std::lock_guard<std::mutex> lock(mutex);
+        write_locked(row);
+    }
+};
+
+void rate(const Job &job, const Options &options, CsvWriter &csv) {
+    std::string command = options.rate + " " + job.caller_file + " " + job.caller_preprocessed + " "
+        + job.callee_out + " 2>> " + options.out_dir + "rate_errors.log";
+    std::vector<std::string> ratings = split(read_output(command), ',');
+
+    std::ifstream stream(job.relay_stats);
+    std::string text((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+    json::Value stats = text.empty() ? json::Value::object() : json::parse(text);
+
+    std::vector<std::string> row = {
+        job.library.version, basename(job.caller_file), job.scenario.alias, basename(job.callee_out),
+    };
+    for (const auto &part : {
+            counters(stats, job.caller_tag), counters(stats, job.callee_tag),
+            timestamps(job.caller_out + ".log"), timestamps(job.callee_out + ".log"), ratings}) {
+        row.insert(row.end(), part.begin(), part.end());
+    }
+    csv.write(row);
+}
+
+// Jobs handed from the call workers to the rating workers.
+class Queue {
+private:
+    std::deque<const Job *> jobs;
+    std::mutex mutex;
+    std::condition_variable ready;
+    bool closed = false;
+
+public:
+    void push(const Job *job) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back(job);
+        }
+        ready.notify_one();
+    }
+
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+        }
+        ready.notify_all();
+    }
+
+    // nullptr once the queue is closed and drained.
+    const Job *pop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        ready.wait(lock, [this] { return closed || !jobs.empty(); });
+        if (jobs.empty())
+            return nullptr;
+        const Job *job = jobs.front();
+        jobs.pop_front();
+        return job;
+    }
+};
+
+void run(std::vector<Job> &jobs, const Options &options) {
+    CsvWriter csv(options.out_dir + "ratings.csv");
+    Queue rating_queue;
+    std::atomic<size_t> next_job(0);
+    std::mutex log_mutex;
+    auto log = [&](const std::string &text) {
+        if (options.verbose) {
+            std::lock_guard<std::mutex> lock(log_mutex);
+            std::cerr << text << std::endl;
+        }
+    };
+
+    std::vector<std::thread> callers;
+    for (unsigned i = 0; i < options.calls; ++i) {
+        callers.emplace_back([&] {
+            for (size_t index; (index = next_job++) < jobs.size();) {
+                Job &job = jobs[index];
+                try {
+                    prepare_call(job, options);
+                    log("> call " + job.library.version + " " + job.scenario.alias + " " + basename(job.callee_out));
+                    int status = run_process({options.tgvoipcall, "--sessions", job.spec_path},
+                                             job.library, job.callee_out + ".sessions.log");
+                    if (status != 0)
+                        log("call " + basename(job.callee_out) + " exited with " + std::to_string(status));
+                    rating_queue.push(&job);
+                }
+                catch (std::exception &err) {
+                    log(err.what());
+                }
+            }
+        });
+    }
+
+    std::vector<std::thread> raters;
+    for (unsigned i = 0; i < options.ratings; ++i) {
+        raters.emplace_back([&] {
+            while (const Job *job = rating_queue.pop()) {
+                try {
+                    log("> rate " + basename(job->callee_out));
+                    rate(*job, options, csv);
+                }
+                catch (std::exception &err) {
+                    log(err.what());
+                }
+            }
+        });
+    }
+
+    for (std::thread &thread : callers)
+        thread.join();
+    rating_queue.close();
+    for (std::thread &thread : raters)
+        thread.join();
+}
+
+}
+
+const char *usage() {
+    return
+    "Usage: tgvoiptest [options] scenarios.json\n"
+    "  scenarios.json       Libraries and network scenarios, see tests/scenarios.json\n"
+    "\n"
+    "Run from the test suite root. Options:\n"
+    " -j, --calls n         Concurrent calls (default: half the cores)\n"
+    " -r, --ratings n       Concurrent ratings (default: the number of cores)\n"
+    " -f, --files n         Sample couples, overrides \"files\" of the scenarios\n"
+    " -x, --speed n         Run the calls n times faster than real time\n"
+    " -s, --seed n          Seed of the sample choice and impairments\n"
+    " -n, --dry-run         Print the calls instead of running them\n"
+    " -v, --verbose         Log calls and ratings as they start\n"
+    "     --tgvoipcall path Default bin/tgvoipcall\n"
+    "     --rate command    Default \"bash tests/rate-async.sh\"\n"
+    "     --samples dir     Default samples\n";
+}
+
+int main(int argc, char *argv[]) {
+    static const struct option long_options[] = {
+        {"calls", required_argument, nullptr, 'j'},
+        {"ratings", required_argument, nullptr, 'r'},
+        {"files", required_argument, nullptr, 'f'},
+        {"speed", required_argument, nullptr, 'x'},
+        {"seed", required_argument, nullptr, 's'},
+        {"dry-run", no_argument, nullptr, 'n'},
+        {"verbose", no_argument, nullptr, 'v'},
+        {"tgvoipcall", required_argument, nullptr, 'T'},
+        {"rate", required_argument, nullptr, 'R'},
+        {"samples", required_argument, nullptr, 'S'},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    test::Options options;
+    options.seed = std::random_device()();
+    int opt;
+    try {
+        while ((opt = getopt_long(argc, argv, "j:r:f:x:s:nv", long_options, nullptr)) != -1) {
+            switch (opt) {
+                case 'j':
+                    options.calls = std::stoul(optarg);
+                    break;
+                case 'r':
+                    options.ratings = std::stoul(optarg);
+                    break;
+                case 'f':
+                    options.files = std::stoi(optarg);
+                    break;
+                case 'x':
+                    options.speed = std::stod(optarg);
+                    break;
+                case 's':
+                    options.seed = std::stoull(optarg);
+                    break;
+                case 'n':
+                    options.dry_run = true;
+                    break;
+                case 'v':
+                    options.verbose = true;
+                    break;
+                case 'T':
+                    options.tgvoipcall = optarg;
+                    break;
+                case 'R':
+                    options.rate = optarg;
+                    break;
+                case 'S':
+                    options.samples = optarg;
+                    break;
+                default:
+                    std::cerr << usage();
+                    return 1;
+            }
+        }
+    }
+    catch (std::exception &err) {
+        std::cerr << usage();
+        return 1;
+    }
+    if (argc - optind != 1) {
+        std::cerr << usage();
+        return 1;
+    }
+
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    if (options.calls == 0)
+        options.calls = std::max(1u, cores / 2);
+    if (options.ratings == 0)
+        options.ratings = cores;
+
+    try {
+        test::Plan plan = test::read_plan(argv[optind]);
+        std::mt19937_64 random(options.seed);
+        std::vector<test::Job> jobs = test::make_jobs(plan, options, random);
+        if (options.dry_run) {
+            for (const test::Job &job : jobs) {
+                std::cout << job.library.version << "\t" << job.scenario.alias << "\t"
+                          << job.caller_file << "\t" << job.callee_file << "\t" << test::basename(job.callee_out);
+                for (const std::string &stage : job.scenario.stages)
+                    std::cout << "\t" << stage;
+                std::cout << std::endl;
+            }
+            return 0;
+        }
+        test::run(jobs, options);
+    }
+    catch (std::exception &err) {
+        std::cerr << err.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -113,6 +113,31 @@ class CallTester {
    * @var string
    */
   private $name = '';
+
+  /**
+   * Address of the local reflector, empty to use the contest API.
+   *
+   * @var string
+   */
+  private $reflector = '';
+  /**
+   * Stats file of the local reflector.
+   *
+   * @var string
+   */
+  private $reflectorStats = '';
+  /**
+   * Whether to impair the caller through bin/tgvoipnetem instead of tc.
+   *
+   * @var boolean
+   */
+  private $userspaceNetem = false;
+  /**
+   * Queued tbf parameters for bin/tgvoipnetem.
+   *
+   * @var string
+   */
+  private $rateSpec = '';
   /**
    * Constructor.
    *
@@ -152,6 +177,13 @@ class CallTester {
    * @return array
    */
   private function fetchParams(): array {
+    if ($this->reflector !== '') {
+      $result = \json_decode($this->execSync("bin/tgvoipreflector --connection {$this->reflector}"), true);
+      if (!($result['ok']??false)) {
+        throw new \Exception("Error while generating local connection parameters");
+      }
+      return $result['result'];
+    }
     $random = \bin2hex(\random_bytes(64));
     $result = \json_decode(\file_get_contents("https://api.contest.com/voip{$this->token}/getConnection?call={$random}") , true);
 
@@ -161,6 +193,55 @@ class CallTester {
 
     return $result['result'];
   }
+  /**
+   * Use a local reflector instead of the contest API.
+   * Start it first with: bin/tgvoipreflector -s out/reflector.json 10.201.202.1:1400
+   *
+   * @param string $address   Reflector address reachable from both namespaces
+   * @param string $statsPath Reflector stats file, replaces interface counters if set
+   *
+   * @return self
+   */
+  public function localReflector(string $address = '10.201.202.1:1400', string $statsPath = ''): self {
+    $this->reflector = $address;
+    $this->reflectorStats = $statsPath;
+    return $this;
+  }
+
+  /**
+   * Impair the caller's traffic with bin/tgvoipnetem, a userspace UDP proxy
+   * between the caller and the relay, instead of tc/netem in the client1
+   * namespace. Both participants then run without namespaces, so several
+   * testers can run in parallel; the impairment is seeded by the iteration
+   * number and reproducible.
+   *
+   * @param bool $enable
+   *
+   * @return self
+   */
+  public function userspaceNetem(bool $enable = true): self {
+    $this->userspaceNetem = $enable;
+    return $this;
+  }
+
+  /**
+   * Traffic of one participant as seen by the local reflector.
+   *
+   * @param string $tag Peer tag of the participant
+   *
+   * @return array [rx bytes, rx packets, tx bytes, tx packets] of the participant
+   */
+  private function reflectorCounters(string $tag): array {
+    $stats = \json_decode(@\file_get_contents($this->reflectorStats), true);
+    $counters = $stats[$tag] ?? [];
+    return [
+      $counters['tx_bytes'] ?? 0,
+      $counters['tx_packets'] ?? 0,
+      $counters['rx_bytes'] ?? 0,
+      $counters['rx_packets'] ?? 0,
+    ];
+  }
+
   /**
    * Start testing session.
    *
@@ -179,6 +260,7 @@ class CallTester {
     $this->commands      = [];
     $this->extraCmd      = '';
     $this->extraCmdUndo  = '';
+    $this->rateSpec      = '';
 
     return $this;
   }
@@ -233,6 +315,7 @@ class CallTester {
     $this->extraCmd = "tc qdisc add dev {$this->dev} root handle 1:0 netem $commands && ".
                       "tc qdisc add dev {$this->dev} parent 1:1 handle 10: tbf rate $rate buffer 1600 limit 3000";
     $this->extraCmdUndo = "tc qdisc del dev {$this->dev} root";
+    $this->rateSpec = trim("$commands rate $rate buffer 1600 limit 3000");
     return $this;
   }
   /**
@@ -305,12 +388,14 @@ class CallTester {
       'commands'     => $this->commands,
       'extraCmd'     => $this->extraCmd,
       'extraCmdUndo' => $this->extraCmdUndo,
+      'rateSpec'     => $this->rateSpec,
       'sleepAfter'   => $delay,
     ];
 
     $this->commands     = [];
     $this->extraCmd     = '';
     $this->extraCmdUndo = '';
+    $this->rateSpec     = '';
     return $this;
   }
 
@@ -354,6 +439,30 @@ class CallTester {
 
     $iteration = mt_rand(1000000, 9999999);
 
+    $this->netemSequence[] = ['commands' => $this->commands, 'extraCmd' => $this->extraCmd, 'extraCmdUndo' => $this->extraCmdUndo, 'rateSpec' => $this->rateSpec, ];
+
+    $proxy = null;
+    $proxyStats = '';
+    $calleeIpPort = $ipPort;
+    if ($this->userspaceNetem) {
+      // The whole tc sequence becomes one proxy schedule, stages relative
+      // to the caller's first packet
+      $stages = [];
+      $start = 0;
+      foreach ($this->netemSequence as $netem) {
+        $spec = trim(\implode(' ', $netem['commands']).' '.$netem['rateSpec']);
+        $stages[] = '-e '.\escapeshellarg("{$start}:{$spec}");
+        $start += $netem['sleepAfter'] ?? 0;
+      }
+      $this->netemSequence = [];
+      $proxyAddress = '127.0.0.1:'.mt_rand(20000, 40000);
+      $proxyStats = "{$this->testdir}out/netem_{$iteration}.json";
+      $proxy = $this->execBackground("exec bin/tgvoipnetem -S {$iteration} -s {$proxyStats} {$proxyAddress} {$ipPort} ".\implode(' ', $stages));
+      usleep(100000);
+      $ipPort = $proxyAddress;
+      $netnsPrefix = $netnsPrefix2 = '';
+    }
+
     $outDir = $this->testdir.'out/';
     $preprocessedDir = $this->testdir.'preprocessed/';
     $configDir = $this->testdir.'out/';
@@ -370,23 +479,27 @@ class CallTester {
     $calleePreprocessedPath = "{$preprocessedDir}{$this->libraryVersion}_{$fileNameCallee}_{$alias}_{$iteration}.pcm";
     $calleeOutPath = "{$outDir}{$this->libraryVersion}_{$fileNameCaller}_{$alias}_{$iteration}.pcm";
     $calleeLogPath = $calleeOutPath.'.log';
-    $calleeCommand = "{$netnsPrefix2} {$ldPreload} {$tgvoipcall_path} {$ipPort} {$calleeTag} -k {$key} -i {$fileCallee} -p {$calleePreprocessedPath} -o {$calleeOutPath} -c {$configPath} -r callee {$netOption} > {$calleeLogPath} 2>&1";
+    $calleeCommand = "{$netnsPrefix2} {$ldPreload} {$tgvoipcall_path} {$calleeIpPort} {$calleeTag} -k {$key} -i {$fileCallee} -p {$calleePreprocessedPath} -o {$calleeOutPath} -c {$configPath} -r callee {$netOption} > {$calleeLogPath} 2>&1";
 
     $callerStatsCommand = "bash -c 'cat /sys/class/net/v-eth1/statistics/{rx,tx}_{bytes,packets}'";
     $callerAfterAddCommand = "grep -oP 'TIMESTAMPS: \K(\d+,\d+,\d+,\d+,\d+)' {$callerLogPath}";
     $calleeStatsCommand = "bash -c 'cat /sys/class/net/v-eth2/statistics/{rx,tx}_{bytes,packets}'";
     $calleeAfterAddCommand = "grep -oP 'TIMESTAMPS: \K(\d+,\d+,\d+,\d+,\d+)' {$calleeLogPath}";
+    if ($proxy) {
+      // No namespace interfaces to count, the proxy stats replace them
+      $callerStatsCommand = $calleeStatsCommand = "printf '0\\n0\\n0\\n0\\n'";
+    }
 
     $beforeStatsCaller = explode("\n", $this->execSync($callerStatsCommand));
     $beforeStatsCallee = explode("\n", $this->execSyncCallee($calleeStatsCommand));
 
     \file_put_contents($configPath, $config);
 
-    $this->netemSequence[] = ['commands' => $this->commands, 'extraCmd' => $this->extraCmd, 'extraCmdUndo' => $this->extraCmdUndo, ];
-
     $curNetem = array_shift($this->netemSequence);
 
-    $this->applyNetem($curNetem);
+    if ($curNetem) {
+      $this->applyNetem($curNetem);
+    }
 
     $caller_pid = $this->execBackground($callerCommand);
     $callee_pid = $this->execBackgroundCallee($calleeCommand);
@@ -401,7 +514,13 @@ class CallTester {
     $this->waitBackground($caller_pid);
     $this->waitBackground($callee_pid);
 
-    $this->undoNetem($curNetem);
+    if ($curNetem) {
+      $this->undoNetem($curNetem);
+    }
+    if ($proxy) {
+      \proc_terminate($proxy);
+      $this->waitBackground($proxy);
+    }
 
     $afterStatsCaller = explode("\n", $this->execSync($callerStatsCommand.' && '.$callerAfterAddCommand));
     $afterStatsCallee = explode("\n", $this->execSyncCallee($calleeStatsCommand.' && '.$calleeAfterAddCommand));
@@ -416,6 +535,25 @@ class CallTester {
     $outBytesCallee   = $afterStatsCallee[2] - $beforeStatsCallee[2];
     $outPacketsCallee = $afterStatsCallee[3] - $beforeStatsCallee[3];
 
+    if ($proxyStats !== '') {
+      // Caller traffic at the proxy: egress is what the caller sent,
+      // ingress what it received
+      $stats = \json_decode(@\file_get_contents($proxyStats), true) ?: [];
+      $flow = reset($stats) ?: [];
+      $inBytesCaller    = $flow['ingress']['sent_bytes'] ?? 0;
+      $inPacketsCaller  = $flow['ingress']['sent_packets'] ?? 0;
+      $outBytesCaller   = $flow['egress']['bytes'] ?? 0;
+      $outPacketsCaller = $flow['egress']['packets'] ?? 0;
+      @\unlink($proxyStats);
+    }
+
+    if ($this->reflectorStats !== '') {
+      // The reflector rewrites its stats file every second
+      usleep(1100000);
+      list($inBytesCaller, $inPacketsCaller, $outBytesCaller, $outPacketsCaller) = $this->reflectorCounters($callerTag);
+      list($inBytesCallee, $inPacketsCallee, $outBytesCallee, $outPacketsCallee) = $this->reflectorCounters($calleeTag);
+    }
+
     $callerTimestamps = explode(',', $afterStatsCaller[4] ?: ',,,,');
     $calleeTimestamps = explode(',', $afterStatsCallee[4] ?: ',,,,');
 
@@ -5,60 +5,50 @@ require_once('tests/CallTester.php');
 // SSH connection with ControlMaster is highly recommended
 // $tester = new CallRemoteTester('10.0.0.2', 'tgvoip-test-suite', $argv[0], true);
 $tester = new CallTester($argv[0], true);
+// To run without api.contest.com, start bin/tgvoipreflector -s out/reflector.json 10.201.202.1:1400 first
+// $tester->localReflector('10.201.202.1:1400', 'out/reflector.json');
+// To impair the caller with bin/tgvoipnetem instead of tc/netem namespaces (local reflector on 127.0.0.1):
+// $tester->localReflector('127.0.0.1:1400', 'out/reflector.json')->userspaceNetem();
+// The same calls run in parallel, without root, with bin/tgvoiptest tests/scenarios.json
+// Libraries and scenarios are read from tests/scenarios.json, add your version there
+$plan = \json_decode(\file_get_contents('tests/scenarios.json'), true);
 
+// Impair the caller as described by a stage of tests/scenarios.json
+function impair(CallTester $tester, array $stage) {
+  if (isset($stage['loss'])) {
+    $tester->loss(...$stage['loss']);
+  }
+  if (isset($stage['delay'])) {
+    $tester->delay(...$stage['delay']);
+  }
+  if (isset($stage['reorder'])) {
+    $tester->reordering(...$stage['reorder']);
+  }
+  if (isset($stage['duplicate'])) {
+    $tester->duplication(...$stage['duplicate']);
+  }
+  if (isset($stage['rate'])) {
+    $tester->rateControl($stage['rate']);
+  }
+  if (isset($stage['after'])) {
+    $tester->after($stage['after']);
+  }
+}
 
-
-$libraries = [
-  'stable'            => 'lib/libtgvoip-stable.so', // Available currently in App Store / Play Market
-  'unstable-2.5'      => 'lib/libtgvoip-unstable.so', // Unstable version, base version for VoIP Contest: Stage 2
-  'unstable-2.6'      => 'lib/libtgvoip-unstable-2.6.so', // Improved unstable version, base version for VoIP Contest: Stage 3
-  // Add your version here
-];
-$files = 2;
+$libraries = $plan['libraries'];
+$files = $plan['files'] ?? 2;
 for ($i = 0; $i < $files; $i++) {
   $tester->chooseCouple(false, ($i % 2) == 0);
   foreach ($libraries as $version => $path) {
-    $tester
-      ->library($version, $path)
-      ->start()
-      ->networkType('wifi')->networkAlias('WiFi')
-      ->end();
-    // continue;
-    $tester
-      ->start()
-      ->loss(9, 20)->rateControl('44kbit')->networkType('hspa')->networkAlias('3G1')
-      ->end()
-      ->start()
-      ->loss(17)->rateControl('29kbit')->networkType('3g')->networkAlias('3G2')
-      ->end()
-      ->start()
-      ->loss(12, 3)->rateControl('32kbit')->networkType('3g')->networkAlias('3G3')
-      ->end()
-      ->start()
-      ->loss(18)->rateControl('32kbit')->networkType('3g')->networkAlias('3G4')
-      ->end()
-      ->start()
-      ->loss(17, 5)->delay(500, 50)->networkType('3g')->networkAlias('3GDelay')
-      ->end()
-      ->start()
-      ->loss(3, 10)->rateControl('64kbit')->after(3)->loss(20)->rateControl('8kbit')->after(3)->rateControl('64kbit')->networkType('3g')->networkAlias('3GOutage')
-      ->end()
-      ->start()
-      ->loss(11)->rateControl('24kbit')->networkType('3g')->networkAlias('EDGE1')
-      ->end()
-      ->start()
-      ->loss(15, 5)->rateControl('19kbit')->networkType('edge')->networkAlias('EDGE2')
-      ->end()
-      ->start()
-      ->loss(20, 5)->rateControl('17kbit')->networkType('gprs')->networkAlias('GPRS1')
-      ->end()
-      ->start()
-      ->loss(19, 5)->rateControl('14kbit')->networkType('gprs')->networkAlias('GPRS2')
-      ->end()
-      ->start()
-      ->loss(40, 5)->delay(500, 50)->rateControl('8kbit')->networkType('gprs')->networkAlias('GPRS3')
-      ->end();
-
+    $tester->library($version, $path);
+    foreach ($plan['scenarios'] as $scenario) {
+      $tester->start();
+      foreach ($scenario['stages'] ?? [] as $stage) {
+        impair($tester, $stage);
+      }
+      $tester
+        ->networkType($scenario['network'] ?? 'wifi')->networkAlias($scenario['alias'])
+        ->end();
+    }
   }
 }
-
@@ -3,6 +3,8 @@
 // Calculates average scores for each library version
 // Usage:
 // php tests/mean.php [path/to/file.csv]
+// bin/tgvoipresults [path/to/file.csv] prints the same tables from an
+// incrementally updated columnar store next to the CSV
 
 require_once('tests/CallTester.php');
 $tester = new CallTester($argv[0], true);
@@ -6,26 +6,47 @@ PREPROCESSED_PATH_PCM=$2
 DISTORTED_PATH_PCM=$3
 
 sample_name=$(basename $SAMPLE_PATH_PCM);
-sample_ogg=$(echo $SAMPLE_PATH_PCM | sed "s/\.pcm$/.ogg/")
 sample_wav=$(echo $SAMPLE_PATH_PCM | sed "s/\.pcm$/.wav/")
-if [ ! -f $sample_ogg ]; then
-  ffmpeg -hide_banner -loglevel panic -y -f s16le -ac 1 -ar 48k -i $SAMPLE_PATH_PCM -f opus $sample_ogg
-fi
-
 duration=$(echo $sample_name | grep -oP '^sample0*\K(\d+)')
 duration=$(($duration + 1))
 
-distorted_ogg=$(echo $DISTORTED_PATH_PCM | sed "s/\.pcm$/.ogg/")
-if [ ! -f $distorted_ogg ]; then
-  ffmpeg -hide_banner -loglevel panic -y -f s16le -ac 1 -ar 48k -i $DISTORTED_PATH_PCM -t $duration -f opus $distorted_ogg
+spectre_cache=$(dirname $SAMPLE_PATH_PCM)/.spectre-cache
+
+# bin/tgvoiprate-all prints the same line in one process
+if [ -n "$TGVOIP_RATE_ALL" ] && [ -x bin/tgvoiprate-all ]; then
+  exec bin/tgvoiprate-all -c $spectre_cache -d $duration $SAMPLE_PATH_PCM $PREPROCESSED_PATH_PCM $DISTORTED_PATH_PCM
+fi
+
+# Builds of bin/tgvoiprate without the spectre cache reject -c
+cache_args=""
+if bin/tgvoiprate -h 2>&1 | grep -q -- '--cache'; then
+  cache_args="-c $spectre_cache"
 fi
-bin/tgvoiprate $SAMPLE_PATH_PCM $DISTORTED_PATH_PCM > $DISTORTED_PATH_PCM.Rate.Short &
-bin/tgvoiprate $SAMPLE_PATH_PCM $PREPROCESSED_PATH_PCM $DISTORTED_PATH_PCM > $DISTORTED_PATH_PCM.Rate.Full &
 
-bin/other_raters/entry997/tgvoiprate $sample_ogg $distorted_ogg > $DISTORTED_PATH_PCM.Rate.997 &
-bin/other_raters/entry1010/tgvoiprate $sample_ogg $distorted_ogg > $DISTORTED_PATH_PCM.Rate.1010 & 
-bin/other_raters/entry1012/tgvoiprate $sample_ogg $distorted_ogg > $DISTORTED_PATH_PCM.Rate.1012 &
-bin/other_raters/entry1002/tgvoiprate $sample_ogg $distorted_ogg > $DISTORTED_PATH_PCM.Rate.1002 & 
+bin/tgvoiprate $cache_args $SAMPLE_PATH_PCM $DISTORTED_PATH_PCM > $DISTORTED_PATH_PCM.Rate.Short &
+bin/tgvoiprate $cache_args $SAMPLE_PATH_PCM $PREPROCESSED_PATH_PCM $DISTORTED_PATH_PCM > $DISTORTED_PATH_PCM.Rate.Full &
+
+# The other raters see the distorted file cut to the sample length plus a
+# second, transcoded to Ogg Opus. Rater builds that read raw PCM can take it
+# directly with TGVOIP_RATE_PCM set.
+if [ -n "$TGVOIP_RATE_PCM" ]; then
+  sample_in=$SAMPLE_PATH_PCM
+  distorted_in=$DISTORTED_PATH_PCM.Cut
+  head -c $(($duration * 96000)) $DISTORTED_PATH_PCM > $distorted_in
+else
+  sample_in=$(echo $SAMPLE_PATH_PCM | sed "s/\.pcm$/.ogg/")
+  if [ ! -f $sample_in ]; then
+    ffmpeg -hide_banner -loglevel panic -y -f s16le -ac 1 -ar 48k -i $SAMPLE_PATH_PCM -f opus $sample_in
+  fi
+  distorted_in=$(echo $DISTORTED_PATH_PCM | sed "s/\.pcm$/.ogg/")
+  if [ ! -f $distorted_in ]; then
+    ffmpeg -hide_banner -loglevel panic -y -f s16le -ac 1 -ar 48k -i $DISTORTED_PATH_PCM -t $duration -f opus $distorted_in
+  fi
+fi
+bin/other_raters/entry997/tgvoiprate $sample_in $distorted_in > $DISTORTED_PATH_PCM.Rate.997 &
+bin/other_raters/entry1010/tgvoiprate $sample_in $distorted_in > $DISTORTED_PATH_PCM.Rate.1010 &
+bin/other_raters/entry1012/tgvoiprate $sample_in $distorted_in > $DISTORTED_PATH_PCM.Rate.1012 &
+bin/other_raters/entry1002/tgvoiprate $sample_in $distorted_in > $DISTORTED_PATH_PCM.Rate.1002 &
 
 if [ -f bin/other_raters/entry1007/src/environment/pesq ]; then
   if [ ! -f $sample_wav ]; then
@@ -40,6 +61,7 @@ if [ -f bin/other_raters/entry1007/src/environment/pesq ]; then
 fi
 
 wait;
+rm -f $DISTORTED_PATH_PCM.Cut
 
 short_score=$(tail -1 $DISTORTED_PATH_PCM.Rate.Short | grep -oP '\K(\d{1}(\.\d{1,})?)')
 full_scores=$(tail -1 $DISTORTED_PATH_PCM.Rate.Full | grep -oP '\K(\d{1}(\.\d{1,})? \d{1}(\.\d{1,})?)' | sed "s/ /,/")